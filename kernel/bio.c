@@ -1,13 +1,46 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Each hash bucket has its own lock, which protects the list
+// of buffers in the bucket and their dev, blockno and refcnt.
+// Lookups of different blocks rarely share a lock.
+//
+// The cache sizes itself from free memory. binit() sets up
+// NBUF buffers in pages of their own, which are never freed,
+// and sets a limit based on the free memory at boot. A miss
+// adds a buffer from the "buf" slab cache while the cache is
+// under that limit and memory is not short; otherwise it
+// evicts the oldest unused buffer among a sample of buckets,
+// judged by per-buffer timestamps, locking only the victim's
+// bucket and the target bucket, never the whole cache.
+// When kalloc() runs dry it calls bshrink(), which frees the
+// slab buffers of whole pages none of whose buffers are in
+// use, until as many pages as kalloc() needs will come free.
+//
+// bread_async() and bwrite_async() start a disk request and
+// return at once, so that a caller can have many requests
+// outstanding; bwait() waits for one to finish. breadahead()
+// starts a read that no one waits for: the disk driver calls
+// back to release the buffer when the read finishes.
+//
+// Requests go to the driver that bdevsw[] lists for the
+// buffer's device: the virtio disk, the ramdisk or the null
+// device (see param.h). A driver that has finished a request
+// clears b->disk and calls b->iodone, if set.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
+// * Or call bread_async or bwrite_async, then bwait before
+//     using the data or reusing the buffer.
+// * The disk may not see such requests until bwait or bkick,
+//     so that it hears of many at once.
+// * A finished write may sit in the disk's cache; call bflush
+//     when it must be on the media before later writes.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -22,70 +55,400 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "sysinfo.h"
 
-struct {
+#define NBUCKET 251   // prime, so that strided block numbers spread out
+#define BSAMPLE 8     // unused buffers bvictim() compares
+#define BMEMFRAC 8    // grow to at most 1/BMEMFRAC of free memory at boot
+#define BLOWMEM 1024  // don't grow when fewer pages are free
+#define NSHRINK 32    // slab pages bshrink() considers at a time
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf head;  // circular list of buffers hashing here
+};
+
+struct bdevsw bdevsw[NBDEV];
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct {
+  struct bucket bucket[NBUCKET];
+  uint64 clock;     // source of buf lastuse timestamps
+  uint hand;        // bucket where the next victim search starts
+  int nbuf;         // buffers in the cache
+  int maxbuf;       // limit on nbuf
+  struct kcache *cache;  // for buffers beyond the first NBUF
+
+  // statistics
+  uint64 hits;      // bread()s that found the block cached
+  uint64 misses;    // bread()s that had to wait for the disk
+  uint64 rastarted; // reads started by breadahead()
+  uint64 rahits;    // bread()s of a block breadahead() brought in
 } bcache;
 
+static inline struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+// Unlink b from its bucket list. Caller holds the bucket lock.
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Insert b at the front of bk's list. Caller holds bk->lock.
+static void
+blink(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+// Constructor for slab buffers.
+static void
+bufctor(void *obj)
+{
+  struct buf *b = obj;
+
+  initsleeplock(&b->lock, "buffer");
+  b->slab = 1;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
+  char *pg = 0;
+  int i, left = 0;
 
-  initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+  bcache.cache = kcache_create("buf", sizeof(struct buf), bufctor);
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  // Carve the permanent buffers out of whole pages. Start
+  // with every buffer in bucket 0; bget() moves them to the
+  // right bucket as it recycles them.
+  for(i = 0; i < NBUF; i++){
+    if(left == 0){
+      if((pg = kalloc()) == 0)
+        panic("binit");
+      left = PGSIZE / sizeof(struct buf);
+    }
+    b = (struct buf*)pg;
+    pg += sizeof(struct buf);
+    left--;
+    memset(b, 0, sizeof(*b));
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    blink(&bcache.bucket[0], b);
+  }
+  bcache.nbuf = NBUF;
+
+  bcache.maxbuf = kfreepages() / BMEMFRAC * (PGSIZE / sizeof(struct buf));
+  if(bcache.maxbuf < NBUF)
+    bcache.maxbuf = NBUF;
+}
+
+// Allocate an extra buffer if the cache may grow.
+// Returns 0 if it may not or memory is short.
+static struct buf*
+bgrow(void)
+{
+  struct buf *b;
+
+  if(bcache.nbuf >= bcache.maxbuf || kfreepages() < BLOWMEM)
+    return 0;
+  if((b = kcache_alloc(bcache.cache)) == 0)
+    return 0;
+  __sync_fetch_and_add(&bcache.nbuf, 1);
+  return b;
+}
+
+// Look for block blockno on device dev in bucket bk.
+// Caller holds bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
+// Is b on bk's list? Caller holds bk->lock.
+static int
+bonlist(struct bucket *bk, struct buf *b)
+{
+  struct buf *x;
+
+  for(x = bk->head.next; x != &bk->head; x = x->next){
+    if(x == b)
+      return 1;
+  }
+  return 0;
+}
+
+// Find the unused buffer released longest ago among the
+// first BSAMPLE unused buffers in the buckets from the hand
+// on, looking at one bucket at a time, and set *vbk to its
+// bucket. The answer may be stale by the time the caller
+// locks *vbk.
+static struct buf*
+bvictim(struct bucket **vbk)
+{
+  struct bucket *bk;
+  struct buf *b, *victim = 0;
+  uint h;
+  int i, seen = 0;
+
+  h = __sync_fetch_and_add(&bcache.hand, 1);
+  for(i = 0; i < NBUCKET && seen < BSAMPLE; i++){
+    bk = &bcache.bucket[(h + i) % NBUCKET];
+    acquire(&bk->lock);
+    for(b = bk->head.next; b != &bk->head; b = b->next){
+      if(b->refcnt != 0)
+        continue;
+      seen++;
+      if(victim == 0 || b->lastuse < victim->lastuse){
+        victim = b;
+        *vbk = bk;
+      }
+    }
+    release(&bk->lock);
+  }
+  return victim;
+}
+
+// Index of the page holding b in pg[0..npg), or -1.
+static int
+bpage(uint64 *pg, int npg, struct buf *b)
+{
+  for(int i = 0; i < npg; i++){
+    if(pg[i] == PGROUNDDOWN((uint64)b))
+      return i;
+  }
+  return -1;
+}
+
+// Free every buffer on slab pages none of whose buffers are
+// in use, until n pages are free or there are no more such
+// pages. The pages reach kalloc() once kmreclaim() flushes
+// the slab magazines. Called by kalloc() when it runs out of
+// pages, so it must not be called with a bucket lock held,
+// and bget() must not hold one while it allocates.
+void
+bshrink(int n)
+{
+  uint64 pg[NSHRINK];
+  char skip[NSHRINK];
+  struct bucket *bk;
+  struct buf *b, *next, *freed;
+  uint h;
+  int i, j, npg, want, nfree = 0;
+
+  while(nfree < n){
+    // gather slab pages from the hand on, and skip those
+    // with a buffer in use. when the table is full, a new
+    // page takes the place of a skipped one; if that page
+    // had a buffer in use, the second pass will notice.
+    npg = 0;
+    h = __sync_fetch_and_add(&bcache.hand, 1);
+    for(i = 0; i < NBUCKET; i++){
+      bk = &bcache.bucket[(h + i) % NBUCKET];
+      acquire(&bk->lock);
+      for(b = bk->head.next; b != &bk->head; b = b->next){
+        if(!b->slab)
+          continue;
+        if((j = bpage(pg, npg, b)) < 0){
+          if(npg < NSHRINK){
+            j = npg++;
+          } else {
+            for(j = 0; j < npg && !skip[j]; j++)
+              ;
+            if(j == npg)
+              continue;
+          }
+          pg[j] = PGROUNDDOWN((uint64)b);
+          skip[j] = 0;
+        }
+        if(b->refcnt != 0)
+          skip[j] = 1;
+      }
+      release(&bk->lock);
+    }
+    want = 0;
+    for(j = 0; j < npg; j++){
+      if(!skip[j] && want < n - nfree)
+        want++;
+      else
+        skip[j] = 1;
+    }
+    if(want == 0)
+      break;
+
+    // free the buffers on the chosen pages. a page one of
+    // whose buffers someone took meanwhile won't come free.
+    for(i = 0; i < NBUCKET; i++){
+      bk = &bcache.bucket[i];
+      freed = 0;
+      acquire(&bk->lock);
+      for(b = bk->head.next; b != &bk->head; b = next){
+        next = b->next;
+        if(!b->slab || (j = bpage(pg, npg, b)) < 0 || skip[j])
+          continue;
+        if(b->refcnt != 0){
+          skip[j] = 1;
+          continue;
+        }
+        bunlink(b);
+        b->next = freed;
+        freed = b;
+      }
+      release(&bk->lock);
+      for(b = freed; b; b = next){
+        next = b->next;
+        __sync_fetch_and_sub(&bcache.nbuf, 1);
+        kmfree(b);
+      }
+    }
+    for(j = 0, i = 0; j < npg; j++)
+      i += !skip[j];
+    if(i == 0)
+      break;
+    nfree += i;
   }
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// If every buffer is in use, panic, or return 0 if canfail.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int canfail)
 {
-  struct buf *b;
+  struct bucket *bk, *vbk;
+  struct buf *b, *hit;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
+  // Add a buffer if the cache may grow.
+  if((b = bgrow()) != 0){
+    acquire(&bk->lock);
+    if((hit = bfind(bk, dev, blockno)) != 0){
+      // someone else cached the block meanwhile.
+      hit->refcnt++;
+      release(&bk->lock);
+      __sync_fetch_and_sub(&bcache.nbuf, 1);
+      kmfree(b);
+      acquiresleep(&hit->lock);
+      return hit;
+    }
+    b->dev = dev;
+    b->blockno = blockno;
+    b->valid = 0;
+    b->ra = 0;
+    b->iodone = 0;
+    b->refcnt = 1;
+    blink(bk, b);
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Otherwise recycle the least recently used (LRU) unused buffer.
+  for(;;){
+    if((b = bvictim(&vbk)) == 0){
+      if(canfail)
+        return 0;
+      panic("bget: no buffers");
+    }
+
+    // lock both buckets, in a fixed order.
+    if(vbk < bk){
+      acquire(&vbk->lock);
+      acquire(&bk->lock);
+    } else {
+      acquire(&bk->lock);
+      if(vbk != bk)
+        acquire(&vbk->lock);
+    }
+
+    // someone else may have cached the block meanwhile.
+    if((hit = bfind(bk, dev, blockno)) != 0){
+      hit->refcnt++;
+      b = hit;
+    } else if(bonlist(vbk, b) && b->refcnt == 0){
+      // the victim is still unused and where we found it.
+      if(vbk != bk){
+        bunlink(b);
+        blink(bk, b);
+      }
       b->dev = dev;
       b->blockno = blockno;
       b->valid = 0;
+      b->ra = 0;
+      b->iodone = 0;
       b->refcnt = 1;
-      release(&bcache.lock);
+    } else {
+      b = 0;
+    }
+
+    if(vbk != bk)
+      release(&vbk->lock);
+    release(&bk->lock);
+    if(b){
       acquiresleep(&b->lock);
       return b;
     }
   }
-  panic("bget: no buffers");
+}
+
+// Drop a reference to b. If it was the last one,
+// stamp b with the time, for bget()'s LRU choice.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    b->lastuse = __sync_fetch_and_add(&bcache.clock, 1);
+  }
+  release(&bk->lock);
+}
+
+// The driver for block device dev.
+static struct bdevsw*
+bdev(uint dev)
+{
+  if(dev >= NBDEV || bdevsw[dev].rw == 0)
+    panic("bdev");
+  return &bdevsw[dev];
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,25 +457,140 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    __sync_fetch_and_add(&bcache.misses, 1);
+    bdev(b->dev)->rw(b, 0);
     b->valid = 1;
+  } else {
+    __sync_fetch_and_add(&bcache.hits, 1);
+  }
+  if(b->ra){
+    __sync_fetch_and_add(&bcache.rahits, 1);
+    b->ra = 0;
+  }
+  return b;
+}
+
+// Return a locked buf for the indicated block, with a read
+// from disk started if it isn't cached. Call bwait() before
+// using the data.
+struct buf*
+bread_async(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  if(!b->valid) {
+    __sync_fetch_and_add(&bcache.misses, 1);
+    bdev(b->dev)->start(b, 0);
+  } else {
+    __sync_fetch_and_add(&bcache.hits, 1);
+  }
+  if(b->ra){
+    __sync_fetch_and_add(&bcache.rahits, 1);
+    b->ra = 0;
   }
   return b;
 }
 
+// Wait for the request started by bread_async()
+// or bwrite_async() on b to finish.  Must be locked.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  bdev(b->dev)->wait(b);
+  b->valid = 1;
+}
+
+// Make sure device dev knows about all the requests started
+// by breadahead(), bread_async() and bwrite_async().
+// bwait() does this itself.
+void
+bkick(uint dev)
+{
+  bdev(dev)->kick();
+}
+
+// Barrier: make every write to dev that has completed
+// (bwrite() returned, or bwait() did for bwrite_async())
+// durable before any write started afterwards.
+void
+bflush(uint dev)
+{
+  bdev(dev)->flush();
+}
+
+// Tell device dev that n blocks starting at blockno are free.
+// Their contents on disk become undefined.
+void
+bdiscard(uint dev, uint blockno, uint n)
+{
+  bdev(dev)->discard(blockno, n);
+}
+
+// Called by the disk driver, in interrupt context, when a
+// read started by breadahead() has finished.
+// Unlocks and releases the buffer on behalf of its starter.
+static void
+breaddone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
+// Start reading the indicated block into the cache, if it
+// isn't there already, without waiting for the disk.
+// Gives up quietly if every buffer is in use.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  // don't wait for a buffer someone else is using.
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b)
+    return;
+
+  if((b = bget(dev, blockno, 1)) == 0)
+    return;
+  if(b->valid){
+    brelse(b);
+    return;
+  }
+  b->ra = 1;
+  b->iodone = breaddone;
+  __sync_fetch_and_add(&bcache.rastarted, 1);
+  bdev(b->dev)->start(b, 0);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  bdev(b->dev)->rw(b, 1);
+}
+
+// Start writing b's contents to disk.  Must be locked.
+// Call bwait() before brelse().
+void
+bwrite_async(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_async");
+  bdev(b->dev)->start(b, 1);
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +598,54 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
+// Allocate a buffer outside the cache, for a caller that
+// needs a private copy of a block, such as the log's
+// snapshots. The caller sets dev and blockno before each
+// bwrite(). Returns 0 if memory is short.
+struct buf*
+bprivate(void)
+{
+  struct buf *b;
 
+  if((b = kcache_alloc(bcache.cache)) == 0)
+    return 0;
+  b->valid = 0;
+  b->disk = 0;
+  b->ra = 0;
+  b->iodone = 0;
+  b->refcnt = 1;
+  b->next = b->prev = 0;
+  return b;
+}
+
+// Fill in the buffer cache fields of *info for sys_sysinfo().
+void
+bstat(struct sysinfo *info)
+{
+  info->nbuf = bcache.nbuf;
+  info->bhits = bcache.hits;
+  info->bmisses = bcache.misses;
+  info->rastarted = bcache.rastarted;
+  info->rahits = bcache.rahits;
+}
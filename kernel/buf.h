@@ -1,12 +1,30 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int diskq;   // disk queue it was started on
+  int slab;    // from the "buf" slab cache, so bshrink() may free it
+  void (*iodone)(struct buf*); // if set, disk calls it when done
+  int ra;      // read by breadahead(), not yet bread()
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint64 lastuse;   // bcache clock at last release, for LRU
+  struct buf *qnext; // next buf in the same disk request
+  struct buf *prev; // hash bucket list
   struct buf *next;
   uchar data[BSIZE];
 };
 
+// map block device number to driver functions.
+struct bdevsw {
+  void (*rw)(struct buf*, int);      // read or write, and wait
+  void (*start)(struct buf*, int);   // start a read or write
+  void (*wait)(struct buf*);         // wait for a started request
+  void (*kick)(void);                // send started requests
+  void (*flush)(void);               // make finished writes durable
+  void (*discard)(uint, uint);       // forget a range of blocks
+};
+
+extern struct bdevsw bdevsw[];
+
@@ -2,20 +2,34 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct ioqueue;
+struct ioreq;
+struct kcache;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct sysinfo;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bread_async(uint, uint);
+void            breadahead(uint, uint);
+void            bwrite_async(struct buf*);
+void            bwait(struct buf*);
+void            bkick(uint);
+struct buf*     bprivate(void);
+void            bflush(uint);
+void            bdiscard(uint, uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bshrink(int);
+void            bstat(struct sysinfo*);
 
 // console.c
 void            consoleinit(void);
@@ -56,22 +70,44 @@ void            itrunc(struct inode*);
 
 // ramdisk.c
 void            ramdiskinit(void);
-void            ramdiskintr(void);
-void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
-int             numFreeMem(void);  // for sys_info
+void*           kalloc_zeroed(void);
+uint64          kfreepages(void);
+int             kzeroidle(void);
+void*           kalloc_order(int);
+void            kfree_order(void *, int);
+void            kmemstat(struct sysinfo*);  // for sys_info
+
+// kmalloc.c
+void            kmallocinit(void);
+struct kcache*  kcache_create(char*, uint, void (*)(void*));
+void*           kcache_alloc(struct kcache*);
+void*           kmalloc(uint);
+void            kmfree(void*);
+void            kmreclaim(void);
+void            kmallocstat(struct sysinfo*);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
+void            log_data(struct buf*);
+void            log_discard(uint);
+void            log_undiscard(uint);
 void            begin_op(void);
+void            begin_opn(int);
+int             log_opmax(void);
 void            end_op(void);
+void            log_sync(void);
+void            log_crash(void);
+int             log_mode(int);
+void            logstat(struct sysinfo*);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -90,6 +126,7 @@ int             growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+void            kthread(char*, void (*)(void));
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -183,6 +220,22 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_start(struct buf *, int);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_kick(void);
+void            virtio_disk_flush(void);
+void            virtio_disk_discard(uint, uint);
+void            virtio_disk_stat(struct sysinfo*);
+int             virtio_disk_sched(int);
+int             virtio_disk_poll(int);
+
+// iosched.c
+void            ioq_init(struct ioqueue*, int);
+int             ioq_setpolicy(struct ioqueue*, int);
+int             ioq_full(struct ioqueue*);
+void            ioq_add(struct ioqueue*, struct buf*, int);
+int             ioq_next(struct ioqueue*, struct ioreq*);
+void            ioq_stat(struct ioqueue*, struct sysinfo*);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
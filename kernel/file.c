@@ -147,19 +147,25 @@ filewrite(struct file *f, uint64 addr, int n)
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
+    // the most log space one FS call may reserve, less the
     // i-node, indirect block, allocation blocks,
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int nlog = log_opmax();
+    int max = ((nlog-1-1-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
+      // reserve only what this chunk may need, so that small
+      // writes leave the transaction room for others.
+      int nres = 2*(n1/BSIZE + 2) + 2;
+      if(nres > nlog)
+        nres = nlog;
 
-      begin_op();
+      begin_opn(nres);
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
@@ -27,6 +27,11 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+
+  // sequential readahead state, see readahead() in fs.c.
+  uint ranext;        // block a sequential reader would read next
+  uint rawin;         // readahead window, in blocks; 0 if not sequential
+  uint raend;         // first block not yet read ahead
 };
 
 // map major device number to device functions.
@@ -46,23 +46,26 @@ fsinit(int dev) {
   initlog(dev, &sb);
 }
 
-// Zero a block.
+// Zero a block, which is file data if data is set.
 static void
-bzero(int dev, int bno)
+bzero(int dev, int bno, int data)
 {
   struct buf *bp;
 
   bp = bread(dev, bno);
   memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  if(data)
+    log_data(bp);
+  else
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Allocate a zeroed disk block, for file data if data is set.
 static uint
-balloc(uint dev)
+balloc(uint dev, int data)
 {
   int b, bi, m;
   struct buf *bp;
@@ -76,7 +79,8 @@ balloc(uint dev)
         bp->data[bi/8] |= m;  // Mark block in use.
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
+        log_undiscard(b + bi);
+        bzero(dev, b + bi, data);
         return b + bi;
       }
     }
@@ -100,6 +104,7 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  log_discard(b);
 }
 
 // Inodes.
@@ -267,6 +272,7 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = ip->rawin = ip->raend = 0;
   release(&icache.lock);
 
   return ip;
@@ -382,7 +388,7 @@ bmap(struct inode *ip, uint bn)
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip->dev, ip->type == T_FILE);
     return addr;
   }
   bn -= NDIRECT;
@@ -390,11 +396,11 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = balloc(ip->dev, 0);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+      a[bn] = addr = balloc(ip->dev, ip->type == T_FILE);
       log_write(bp);
     }
     brelse(bp);
@@ -448,6 +454,43 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+#define RAMIN 2    // initial readahead window, in blocks
+#define RAMAX 16   // largest readahead window
+
+// readi() is about to read block bn of ip. If ip is being
+// read sequentially, start reading the blocks after bn,
+// doubling the window each time the reader keeps going.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn)
+{
+  uint b, last;
+
+  if(bn + 1 == ip->ranext)
+    return;  // another read within the same block
+  if(bn == ip->ranext && bn != 0){
+    ip->rawin = ip->rawin ? ip->rawin * 2 : RAMIN;
+    if(ip->rawin > RAMAX)
+      ip->rawin = RAMAX;
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ranext = bn + 1;
+  if(ip->rawin == 0 || ip->size == 0)
+    return;
+
+  last = (ip->size - 1) / BSIZE;
+  if(bn + ip->rawin < last)
+    last = bn + ip->rawin;
+  b = ip->raend > bn + 1 ? ip->raend : bn + 1;
+  for(; b <= last; b++)
+    breadahead(ip->dev, bmap(ip, b));
+  bkick(ip->dev);
+  if(b > ip->raend)
+    ip->raend = b;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -464,6 +507,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    readahead(ip, off/BSIZE);
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
@@ -497,7 +541,10 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
-    log_write(bp);
+    if(ip->type == T_FILE)
+      log_data(bp);  // see log.c for ordered data
+    else
+      log_write(bp);
     brelse(bp);
   }
 
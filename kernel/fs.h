@@ -20,10 +20,50 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint flags;        // FS_* flags
 };
 
 #define FSMAGIC 0x10203040
 
+#define FS_ORDERED 0x1  // journal only metadata, not file data; see log.c
+
+// The log's first block is a struct logtail, saying where
+// recovery starts. The other nlog-1 blocks are a circular
+// journal of committed transactions, each a header block
+// followed by the logged blocks, wrapping around at the end.
+// A header's sum covers the header from seq through
+// block[n-1] and then the n logged blocks, so recovery can
+// tell a whole transaction from one that a crash cut short.
+#define LOGMAGIC 0x6c6f6721
+#define MAXLOG ((BSIZE - 4*sizeof(uint)) / sizeof(uint))  // blocks a header can list
+
+struct logtail {
+  uint magic;        // Must be LOGMAGIC
+  uint seq;          // seq of the oldest transaction not installed
+  uint pos;          // journal position of its header
+};
+
+struct logheader {
+  uint magic;        // Must be LOGMAGIC
+  uint sum;          // logsum() of the rest of the transaction
+  uint seq;          // one more than the previous transaction's
+  int n;             // number of logged blocks
+  int block[MAXLOG]; // their home block numbers
+};
+
+#define LOGSUMINIT 2166136261U
+
+// FNV-1a hash of n bytes at p, continuing from h.
+static inline uint
+logsum(uint h, void *p, int n)
+{
+  uchar *s = p;
+
+  while(n-- > 0)
+    h = (h ^ *s++) * 16777619U;
+  return h;
+}
+
 #define NDIRECT 12
 #define NINDIRECT (BSIZE / sizeof(uint))
 #define MAXFILE (NDIRECT + NINDIRECT)
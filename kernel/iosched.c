@@ -0,0 +1,220 @@
+// I/O scheduler.
+//
+// The disk driver puts each buf it is asked to read or write
+// in an ioqueue, and later takes requests out of the queue to
+// give to the device. In between, the queue's policy may merge
+// the buf into a queued request for neighbouring blocks, and
+// chooses which request goes to the device next.
+//
+// noop: requests go out in arrival order; a buf joins only
+// the newest request, when it continues that request's run.
+//
+// deadline: a buf joins any queued request it extends at
+// either end. Requests go out in one sweep up the disk,
+// starting over at the lowest block when none are left above
+// the last one (C-LOOK), except that a request waiting past
+// its deadline goes first.
+//
+// The caller provides the locking.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "sysinfo.h"
+#include "iosched.h"
+
+#define RDEADLINE 1   // ticks a read may wait in the queue
+#define WDEADLINE 5   // ticks a write may wait in the queue
+
+// The queued request that arrived last or first,
+// or 0 if the queue is empty.
+static struct ioreq*
+newest(struct ioqueue *q)
+{
+  struct ioreq *r, *best = 0;
+
+  for(r = q->req; r < q->req + NIOREQ; r++)
+    if(r->nseg && (best == 0 || r->seq - best->seq < (1U << 31)))
+      best = r;
+  return best;
+}
+
+static struct ioreq*
+oldest(struct ioqueue *q)
+{
+  struct ioreq *r, *best = 0;
+
+  for(r = q->req; r < q->req + NIOREQ; r++)
+    if(r->nseg && (best == 0 || best->seq - r->seq < (1U << 31)))
+      best = r;
+  return best;
+}
+
+static int
+noop_merge(struct ioqueue *q, struct buf *b, int write)
+{
+  struct ioreq *r;
+
+  if((r = newest(q)) == 0 || r->write != write || r->nseg >= q->maxseg)
+    return 0;
+  if(r->last->blockno + 1 == b->blockno){
+    r->last->qnext = b;
+    r->last = b;
+    r->nseg++;
+    return 1;
+  }
+  return 0;
+}
+
+static struct ioreq*
+noop_pick(struct ioqueue *q)
+{
+  return oldest(q);
+}
+
+static int
+deadline_merge(struct ioqueue *q, struct buf *b, int write)
+{
+  struct ioreq *r;
+
+  for(r = q->req; r < q->req + NIOREQ; r++){
+    if(r->nseg == 0 || r->write != write || r->nseg >= q->maxseg)
+      continue;
+    if(r->last->blockno + 1 == b->blockno){
+      r->last->qnext = b;
+      r->last = b;
+      r->nseg++;
+      return 1;
+    }
+    if(b->blockno + 1 == r->first->blockno){
+      b->qnext = r->first;
+      r->first = b;
+      r->nseg++;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static struct ioreq*
+deadline_pick(struct ioqueue *q)
+{
+  struct ioreq *r, *up = 0, *low = 0;
+
+  r = oldest(q);
+  if(r == 0 || (int)(ticks - r->deadline) >= 0)
+    return r;
+
+  for(r = q->req; r < q->req + NIOREQ; r++){
+    if(r->nseg == 0)
+      continue;
+    if(r->first->blockno >= q->pos &&
+       (up == 0 || r->first->blockno < up->first->blockno))
+      up = r;
+    if(low == 0 || r->first->blockno < low->first->blockno)
+      low = r;
+  }
+  return up ? up : low;
+}
+
+static struct {
+  int (*merge)(struct ioqueue*, struct buf*, int);
+  struct ioreq* (*pick)(struct ioqueue*);
+} policies[] = {
+[IOSCHED_NOOP]      { noop_merge, noop_pick },
+[IOSCHED_DEADLINE]  { deadline_merge, deadline_pick },
+};
+
+void
+ioq_init(struct ioqueue *q, int maxseg)
+{
+  memset(q, 0, sizeof(*q));
+  q->maxseg = maxseg;
+  q->policy = IOSCHED_DEADLINE;
+}
+
+// Set q's policy. Returns the old one, or -1 if
+// policy isn't one.
+int
+ioq_setpolicy(struct ioqueue *q, int policy)
+{
+  int old = q->policy;
+
+  if(policy < 0 || policy >= NELEM(policies))
+    return -1;
+  q->policy = policy;
+  return old;
+}
+
+// Is there no room for another request?
+int
+ioq_full(struct ioqueue *q)
+{
+  return q->n == NIOREQ;
+}
+
+// Add a read or write of b to q. The caller has
+// checked that q isn't full.
+void
+ioq_add(struct ioqueue *q, struct buf *b, int write)
+{
+  struct ioreq *r;
+
+  b->qnext = 0;
+  q->nqueued++;
+  if(policies[q->policy].merge(q, b, write)){
+    q->nmerged++;
+    return;
+  }
+
+  for(r = q->req; r < q->req + NIOREQ; r++)
+    if(r->nseg == 0)
+      break;
+  if(r == q->req + NIOREQ)
+    panic("ioq_add");
+  r->first = r->last = b;
+  r->nseg = 1;
+  r->write = write;
+  r->seq = q->seq++;
+  r->deadline = ticks + (write ? WDEADLINE : RDEADLINE);
+  q->n++;
+}
+
+// Take the next request for the device out of q into *out.
+// Returns 0 if q is empty.
+int
+ioq_next(struct ioqueue *q, struct ioreq *out)
+{
+  struct ioreq *r;
+
+  if(q->n == 0)
+    return 0;
+  r = policies[q->policy].pick(q);
+  *out = *r;
+  r->nseg = 0;
+  q->n--;
+
+  q->ndispatched++;
+  if(out->first->blockno >= q->pos)
+    q->nseek += out->first->blockno - q->pos;
+  else
+    q->nseek += q->pos - out->first->blockno;
+  q->pos = out->last->blockno + 1;
+  return 1;
+}
+
+// Add q's statistics to the I/O scheduler fields of *info.
+void
+ioq_stat(struct ioqueue *q, struct sysinfo *info)
+{
+  info->iosched = q->policy;
+  info->ioqueued += q->nqueued;
+  info->iomerged += q->nmerged;
+  info->iodispatched += q->ndispatched;
+  info->ioseek += q->nseek;
+}
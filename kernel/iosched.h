@@ -0,0 +1,30 @@
+// I/O scheduler: disk requests that have been started
+// but not yet given to the device. See iosched.c.
+
+#define NIOREQ 64  // requests an ioqueue holds
+
+// a disk request: bufs for a run of consecutive blocks,
+// linked through qnext.
+struct ioreq {
+  struct buf *first;
+  struct buf *last;
+  int nseg;          // bufs in the run; 0 if this slot is free
+  int write;
+  uint seq;          // arrival order
+  uint deadline;     // ticks by which it should go to the device
+};
+
+struct ioqueue {
+  struct ioreq req[NIOREQ];
+  int n;             // requests queued
+  uint seq;          // next arrival number
+  uint pos;          // block after the last dispatched request
+  int maxseg;        // most bufs in one request
+  int policy;        // IOSCHED_NOOP or IOSCHED_DEADLINE
+
+  // statistics
+  uint64 nqueued;    // bufs added
+  uint64 nmerged;    // bufs that joined a queued request
+  uint64 ndispatched; // requests handed to the device
+  uint64 nseek;      // blocks between consecutive dispatched requests
+};
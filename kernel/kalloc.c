@@ -1,6 +1,35 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// and physically contiguous runs of 2^k pages.
+//
+// Free memory lives in a buddy allocator: free blocks of
+// 2^k pages (k <= MAXORDER, so up to 2MB), aligned to their
+// size, on one list per order. Freeing a block merges it
+// with its buddy whenever the buddy is free too.
+//
+// On top of that, each hart keeps its own cache of single
+// free pages, so that kalloc() and kfree() usually take
+// only that hart's lock. A hart refills an empty cache from
+// the buddy allocator KBATCH pages at a time, gives KBATCH
+// pages back when its cache reaches KHIGH pages, and steals
+// half of another hart's cache when the buddy allocator is
+// empty too. Pages in hart caches look allocated to the
+// buddy allocator, so kalloc_order() drains the caches
+// before giving up on a large block.
+//
+// Harts with nothing to run zero free pages into a clean
+// pool (kzeroidle(), called from scheduler()), so that
+// kalloc_zeroed() can usually return a page without writing
+// it. Pages in the pool still count as free; kalloc() falls
+// back to them when every other list is empty.
+//
+// Unless the kernel is built with PRODUCTION defined, kalloc()
+// and kfree() fill pages with junk to catch dangling refs.
+//
+// Page counts are kept up to date by the allocation and
+// free routines, so kmemstat() can report them without
+// locks and without walking the free lists.
 
 #include "types.h"
 #include "param.h"
@@ -8,58 +37,396 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "sysinfo.h"
+
+#define KBATCH 32          // pages moved between a hart and the buddy lists
+#define KHIGH  (2*KBATCH)  // hart cache size that triggers a spill
+
+#define KZEROMAX 256      // pages idle harts keep zeroed
+#define KZEROLOW (8*KZEROMAX)  // don't zero when fewer pages are free
+
+#define NPAGE  ((PHYSTOP - KERNBASE) / PGSIZE)
 
 void freerange(void *pa_start, void *pa_end);
+static void bfree(void *pa, int k);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
 struct run {
   struct run *next;
+  struct run *prev;  // buddy free lists only
+};
+
+// per-hart cache of single pages.
+struct kmem {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;             // number of pages on freelist
 };
 
+struct kmem kcpu[NCPU];
+
+struct {
+  struct spinlock lock;
+  struct run free[MAXORDER+1];    // circular list heads, one per order
+  uint64 nblocks[MAXORDER+1];     // number of blocks on each list
+  char order[NPAGE];              // 1+order if page heads a free block
+} buddy;
+
+// pool of free pages that are already zero, apart from
+// the list link in the first word.
 struct {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int n;
+} kzero;
+
+struct {
+  uint64 npages;  // pages managed by the allocator
+  uint64 nfree;   // pages currently free, wherever they are cached
+} kstat;
+
+static inline uint64
+pgidx(void *pa)
+{
+  return ((uint64)pa - KERNBASE) / PGSIZE;
+}
+
+static inline struct run *
+pgaddr(uint64 i)
+{
+  return (struct run *)(KERNBASE + i*PGSIZE);
+}
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  initlock(&buddy.lock, "kmem");
+  for(int k = 0; k <= MAXORDER; k++)
+    buddy.free[k].next = buddy.free[k].prev = &buddy.free[k];
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcpu[i].lock, "kmem_cpu");
+  initlock(&kzero.lock, "kzero");
   freerange(end, (void*)PHYSTOP);
 }
 
-void   // add all mem whose address between end and PHYSTOP to free list
-freerange(void *pa_start, void *pa_end)  // subroutine for kinit
+// add all mem whose address between end and PHYSTOP to free list.
+// subroutine for kinit.
+// hands the range to the buddy allocator as the largest
+// aligned blocks that fit, rather than page by page, so
+// boot does not touch every page or take a lock per page.
+// blocks are split into pages on demand by balloc().
+void
+freerange(void *pa_start, void *pa_end)
 {
   char *p;
+  int k;
+
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  acquire(&buddy.lock);
+  while(p + PGSIZE <= (char*)pa_end){
+    for(k = MAXORDER; k > 0; k--){
+      if(pgidx(p) % (1L << k) == 0 && p + (PGSIZE << k) <= (char*)pa_end)
+        break;
+    }
+    bfree(p, k);
+    kstat.npages += 1L << k;
+    kstat.nfree += 1L << k;
+    p += PGSIZE << k;
+  }
+  release(&buddy.lock);
+}
+
+// Put the free block r of order k on its list.
+// Caller must hold buddy.lock.
+static void
+bpush(struct run *r, int k)
+{
+  struct run *h = &buddy.free[k];
+
+  r->next = h->next;
+  r->prev = h;
+  h->next->prev = r;
+  h->next = r;
+  buddy.order[pgidx(r)] = k + 1;
+  buddy.nblocks[k]++;
+}
+
+// Take the free block r of order k off its list.
+// Caller must hold buddy.lock.
+static void
+bremove(struct run *r, int k)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  buddy.order[pgidx(r)] = 0;
+  buddy.nblocks[k]--;
+}
+
+// Allocate a block of 2^k pages, splitting a larger
+// block if there is no free one of that order.
+// Caller must hold buddy.lock.
+static struct run *
+balloc(int k)
+{
+  struct run *r;
+  int j;
+
+  for(j = k; j <= MAXORDER; j++)
+    if(buddy.free[j].next != &buddy.free[j])
+      break;
+  if(j > MAXORDER)
+    return 0;
+
+  r = buddy.free[j].next;
+  bremove(r, j);
+  while(j > k){
+    // give back the upper half.
+    j--;
+    bpush(pgaddr(pgidx(r) + (1L << j)), j);
+  }
+  return r;
+}
+
+// Free a block of 2^k pages, merging it with its buddy
+// for as long as the buddy is free as well.
+// Caller must hold buddy.lock.
+static void
+bfree(void *pa, int k)
+{
+  uint64 i, b;
+
+  i = pgidx(pa);
+  while(k < MAXORDER){
+    b = i ^ (1L << k);
+    if(b >= NPAGE || buddy.order[b] != k + 1)
+      break;
+    bremove(pgaddr(b), k);
+    i &= ~(1L << k);
+    k++;
+  }
+  bpush(pgaddr(i), k);
+}
+
+// Detach up to n pages from the front of km's freelist.
+// Returns the chain, its last page in *tail and its length
+// in *cnt. Caller must hold km->lock.
+static struct run *
+ktake(struct kmem *km, int n, struct run **tail, int *cnt)
+{
+  struct run *head, *r;
+  int i;
+
+  head = km->freelist;
+  if(head == 0 || n <= 0){
+    *cnt = 0;
+    return 0;
+  }
+  r = head;
+  for(i = 1; i < n && r->next; i++)
+    r = r->next;
+  km->freelist = r->next;
+  km->n -= i;
+  r->next = 0;
+  *tail = r;
+  *cnt = i;
+  return head;
+}
+
+// Push a chain of cnt pages from ktake() onto km's freelist.
+// Caller must hold km->lock.
+static void
+kput(struct kmem *km, struct run *head, struct run *tail, int cnt)
+{
+  if(head == 0)
+    return;
+  tail->next = km->freelist;
+  km->freelist = head;
+  km->n += cnt;
+}
+
+// Give a chain of single pages back to the buddy allocator.
+// Caller must hold buddy.lock.
+static void
+bspill(struct run *head)
+{
+  struct run *r;
+
+  while(head){
+    r = head;
+    head = r->next;
+    bfree(r, 0);
+  }
+}
+
+// Find pages for hart id, whose cache is empty: a batch
+// from the buddy allocator if it has any, otherwise half
+// of the first non-empty cache of another hart. Takes one
+// lock at a time, so the caller must not hold kcpu[id].lock.
+static struct run *
+krefill(int id, struct run **tail, int *cnt)
+{
+  struct run *head, *r;
+  int n;
+
+  head = 0;
+  acquire(&buddy.lock);
+  for(n = 0; n < KBATCH; n++){
+    if((r = balloc(0)) == 0)
+      break;
+    if(head == 0)
+      *tail = r;
+    r->next = head;
+    head = r;
+  }
+  release(&buddy.lock);
+  *cnt = n;
+  if(head)
+    return head;
+
+  for(int i = 0; i < NCPU; i++){
+    if(i == id)
+      continue;
+    acquire(&kcpu[i].lock);
+    head = ktake(&kcpu[i], (kcpu[i].n + 1) / 2, tail, cnt);
+    release(&kcpu[i].lock);
+    if(head)
+      return head;
+  }
+  return 0;
+}
+
+// Return every page cached by a hart to the buddy allocator,
+// so that it can be merged into larger blocks.
+static void
+kdrain(void)
+{
+  struct run *head, *tail;
+  int cnt;
+
+  for(int i = 0; i < NCPU; i++){
+    acquire(&kcpu[i].lock);
+    head = ktake(&kcpu[i], kcpu[i].n, &tail, &cnt);
+    release(&kcpu[i].lock);
+    acquire(&buddy.lock);
+    bspill(head);
+    release(&buddy.lock);
+  }
+
+  acquire(&kzero.lock);
+  head = kzero.freelist;
+  kzero.freelist = 0;
+  kzero.n = 0;
+  release(&kzero.lock);
+  acquire(&buddy.lock);
+  bspill(head);
+  release(&buddy.lock);
+}
+
+// Take a page from the pool of zeroed pages, or return 0.
+// The page is entirely zero.
+static struct run *
+kzerotake(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.freelist;
+  if(r){
+    kzero.freelist = r->next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
+  if(r)
+    r->next = 0;
+  return r;
 }
 
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// call to kalloc().
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *head, *tail;
+  struct kmem *km;
+  int cnt;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+#ifndef PRODUCTION
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
+  __sync_fetch_and_add(&kstat.nfree, 1);
+
+  push_off();
+  km = &kcpu[cpuid()];
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->n++;
+  if(km->n >= KHIGH){
+    // spill a batch to the buddy allocator.
+    head = ktake(km, KBATCH, &tail, &cnt);
+    acquire(&buddy.lock);
+    bspill(head);
+    release(&buddy.lock);
+  }
+  release(&km->lock);
+  pop_off();
+}
+
+// Take one page from this hart's cache, refilling it
+// if it is empty.
+static struct run *
+kcpualloc(void)
+{
+  struct run *r, *head, *tail;
+  struct kmem *km;
+  int id, cnt;
+
+  push_off();
+  id = cpuid();
+  km = &kcpu[id];
+  acquire(&km->lock);
+  if(km->freelist == 0){
+    release(&km->lock);
+    head = krefill(id, &tail, &cnt);
+    acquire(&km->lock);
+    kput(km, head, tail, cnt);
+  }
+  r = km->freelist;
+  if(r){
+    km->freelist = r->next;
+    km->n--;
+  }
+  release(&km->lock);
+  pop_off();
+  return r;
+}
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+// Take a free page from wherever one can be found.
+static struct run *
+kget(void)
+{
+  struct run *r;
+
+  if((r = kcpualloc()) == 0){
+    // the buffer cache and slab caches may be holding
+    // pages they don't need.
+    bshrink(1);
+    kmreclaim();
+    if((r = kcpualloc()) == 0)
+      r = kzerotake();
+  }
+  if(r)
+    __sync_fetch_and_sub(&kstat.nfree, 1);
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -70,28 +437,134 @@ kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
-
+  r = kget();
+#ifndef PRODUCTION
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
   return (void*)r;
 }
 
-// returns num of free memory bytes
-// for lab2 sysinfo syscall 
+// Allocate one page of physical memory, filled with zeros.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  if((r = kzerotake()) != 0){
+    __sync_fetch_and_sub(&kstat.nfree, 1);
+    return (void*)r;
+  }
+  if((r = kget()) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Called by scheduler() when this hart has nothing to run.
+// Zeroes one free page into the clean pool, unless the pool
+// is full or memory is short. Returns 1 if it did any work,
+// 0 if the hart may as well wait for an interrupt.
 int
-numFreeMem() {
-	int k = 0;
-	struct run *p;
+kzeroidle(void)
+{
+  struct run *r;
+
+  if(kzero.n >= KZEROMAX || kstat.nfree < KZEROLOW)
+    return 0;
+  if((r = kcpualloc()) == 0)
+    return 0;
+  memset((char*)r, 0, PGSIZE);
+  acquire(&kzero.lock);
+  r->next = kzero.freelist;
+  kzero.freelist = r;
+  kzero.n++;
+  release(&kzero.lock);
+  return 1;
+}
 
-	acquire(&kmem.lock);
-	for (p = kmem.freelist; p; p = p->next)
-		k++;
-	release(&kmem.lock);
+// Allocate 2^k physically contiguous pages, aligned to
+// their size. Returns 0 if there is no such free block.
+void *
+kalloc_order(int k)
+{
+  struct run *r;
+
+  if(k == 0)
+    return kalloc();
+  if(k < 0 || k > MAXORDER)
+    return 0;
 
-	return k*PGSIZE;
+  acquire(&buddy.lock);
+  r = balloc(k);
+  release(&buddy.lock);
+  if(r == 0){
+    // the pages we need may be sitting in the buffer cache,
+    // or in slab, hart or zeroed-page caches.
+    bshrink(1 << k);
+    kmreclaim();
+    kdrain();
+    acquire(&buddy.lock);
+    r = balloc(k);
+    release(&buddy.lock);
+  }
+
+  if(r){
+    __sync_fetch_and_sub(&kstat.nfree, 1L << k);
+#ifndef PRODUCTION
+    memset((char*)r, 5, PGSIZE << k); // fill with junk
+#endif
+  }
+  return (void*)r;
+}
+
+// Free a block of 2^k pages returned by kalloc_order(k).
+void
+kfree_order(void *pa, int k)
+{
+  if(k == 0){
+    kfree(pa);
+    return;
+  }
+  if(k < 0 || k > MAXORDER || ((uint64)pa % (PGSIZE << k)) != 0 ||
+     (char*)pa < end || (uint64)pa + (PGSIZE << k) > PHYSTOP)
+    panic("kfree_order");
+
+#ifndef PRODUCTION
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, PGSIZE << k);
+#endif
+
+  __sync_fetch_and_add(&kstat.nfree, 1L << k);
+  acquire(&buddy.lock);
+  bfree(pa, k);
+  release(&buddy.lock);
+}
+
+// Number of free pages, without locking.
+uint64
+kfreepages(void)
+{
+  return kstat.nfree;
+}
+
+// Fill in the memory fields of *info for sys_sysinfo().
+// Reads the counters without taking any lock; aligned
+// 64-bit and 32-bit loads are atomic on RISC-V, so each
+// value is one that the counter really held, though they
+// may be from slightly different moments.
+void
+kmemstat(struct sysinfo *info)
+{
+  info->freemem = kstat.nfree * PGSIZE;
+  info->totalmem = kstat.npages * PGSIZE;
+  // sysinfo.h can't see param.h, so it sizes these itself.
+  _Static_assert(NELEM(info->cpufree) >= NCPU, "sysinfo.h: cpufree[] < NCPU");
+  _Static_assert(NELEM(info->freeblocks) > MAXORDER,
+                 "sysinfo.h: freeblocks[] <= MAXORDER");
+  for(int i = 0; i < NELEM(info->cpufree); i++)
+    info->cpufree[i] = i < NCPU ? kcpu[i].n : 0;
+  for(int k = 0; k < NELEM(info->freeblocks); k++)
+    info->freeblocks[k] = k <= MAXORDER ? buddy.nblocks[k] : 0;
+  info->zeromem = kzero.n * PGSIZE;
 }
@@ -0,0 +1,332 @@
+// Slab allocator for kernel objects smaller than a page.
+//
+// A kcache hands out objects of one size. It carves whole
+// pages from kalloc() into slabs: a struct slab header at
+// the start of the page, then a stack of the indices of the
+// slab's free objects, then as many objects as fit.
+// Objects are constructed (by the cache's ctor, if any) once,
+// when their slab is created, and go back to the cache in
+// constructed state, so a reused object needs no setup.
+// That is why free objects are tracked outside the objects
+// themselves, in the index stack and in the magazines.
+//
+// Each hart has a small magazine of free objects per cache,
+// so kcache_alloc() and kmfree() usually touch only that
+// hart's magazine. Magazines are refilled from and flushed
+// to the slabs MAGSIZE/2 objects at a time. A slab whose
+// objects are all free again is given back to kalloc().
+//
+// kmalloc(n) allocates from the smallest general-purpose
+// cache whose objects hold n bytes; kmfree() frees objects
+// from any cache, finding the cache through the slab header.
+// There is no 2048-byte cache: with the header in the page,
+// only one such object would fit, so kmalloc() hands out a
+// whole page from kalloc() for anything over 1024 bytes, and
+// kmfree() knows it by its page alignment, which no slab
+// object has.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "sysinfo.h"
+
+#define NKCACHE  16   // maximum number of caches
+#define MAGSIZE  16   // objects in a full magazine
+
+struct slab {
+  struct kcache *cache;
+  struct slab *next;   // cache's list of slabs with free objects
+  struct slab *prev;
+  int nfree;           // number of entries in freeidx[]
+  uchar freeidx[];     // indices of free objects
+};
+
+struct magazine {
+  struct spinlock lock;
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct kcache {
+  char *name;
+  uint size;           // object size, 0 if this entry is unused
+  int nobj;            // objects per slab
+  int off;             // offset of the first object in a slab
+  void (*ctor)(void*);
+
+  struct spinlock lock;
+  struct slab partial; // head of circular list of slabs with free objects
+  uint64 nslabs;       // pages held by this cache
+  uint64 nalloc;       // objects held by callers
+
+  struct magazine mag[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  struct kcache cache[NKCACHE];
+} kmcache;
+
+// general-purpose caches used by kmalloc(), smallest first.
+static uint kmsizes[] = { 32, 64, 128, 256, 512, 1024 };
+static struct kcache *kmgeneral[NELEM(kmsizes)];
+
+void
+kmallocinit(void)
+{
+  static char *names[] = { "kmalloc-32", "kmalloc-64", "kmalloc-128",
+                           "kmalloc-256", "kmalloc-512", "kmalloc-1024" };
+
+  initlock(&kmcache.lock, "kmcache");
+  for(int i = 0; i < NELEM(kmsizes); i++)
+    kmgeneral[i] = kcache_create(names[i], kmsizes[i], 0);
+}
+
+// Create a cache of objects of the given size.
+// ctor, if not 0, is called once on every new object.
+struct kcache*
+kcache_create(char *name, uint size, void (*ctor)(void*))
+{
+  struct kcache *c;
+
+  size = (size + 15) & ~15;
+  if(size == 0 || size > PGSIZE - 64)
+    panic("kcache_create: size");
+
+  acquire(&kmcache.lock);
+  for(c = kmcache.cache; c < kmcache.cache + NKCACHE; c++){
+    if(c->size == 0)
+      break;
+  }
+  if(c == kmcache.cache + NKCACHE)
+    panic("kcache_create: no caches");
+
+  c->name = name;
+  // fit the header, one index byte per object, and the
+  // objects themselves into a page.
+  c->nobj = (PGSIZE - sizeof(struct slab)) / (size + 1);
+  if(c->nobj > 255)
+    c->nobj = 255;
+  while((c->off = (sizeof(struct slab) + c->nobj + 15) & ~15) +
+        c->nobj * size > PGSIZE)
+    c->nobj--;
+  c->ctor = ctor;
+  initlock(&c->lock, name);
+  c->partial.next = c->partial.prev = &c->partial;
+  for(int i = 0; i < NCPU; i++)
+    initlock(&c->mag[i].lock, "kmag");
+  __sync_synchronize();
+  c->size = size;  // publish to kmreclaim() and kmallocstat()
+  release(&kmcache.lock);
+  return c;
+}
+
+static inline void*
+slab_obj(struct kcache *c, struct slab *s, int i)
+{
+  return (char*)s + c->off + i * c->size;
+}
+
+// Move up to n free objects from c's slabs into objs[].
+// Returns the number moved.
+static int
+slab_take(struct kcache *c, void **objs, int n)
+{
+  struct slab *s;
+  int i = 0;
+
+  acquire(&c->lock);
+  while(i < n && (s = c->partial.next) != &c->partial){
+    while(i < n && s->nfree > 0)
+      objs[i++] = slab_obj(c, s, s->freeidx[--s->nfree]);
+    if(s->nfree == 0){
+      // slab is full; take it off the partial list.
+      s->prev->next = s->next;
+      s->next->prev = s->prev;
+    }
+  }
+  release(&c->lock);
+  return i;
+}
+
+// Return n objects to their slabs, and give slabs that
+// become completely free back to kalloc().
+static void
+slab_put(struct kcache *c, void **objs, int n)
+{
+  struct slab *s, *empty = 0;
+
+  acquire(&c->lock);
+  for(int i = 0; i < n; i++){
+    s = (struct slab*)PGROUNDDOWN((uint64)objs[i]);
+    if(s->nfree == 0){
+      // slab was full; it has a free object again.
+      s->next = c->partial.next;
+      s->prev = &c->partial;
+      c->partial.next->prev = s;
+      c->partial.next = s;
+    }
+    s->freeidx[s->nfree++] = ((char*)objs[i] - (char*)s - c->off) / c->size;
+    if(s->nfree == c->nobj){
+      s->prev->next = s->next;
+      s->next->prev = s->prev;
+      s->next = empty;
+      empty = s;
+      c->nslabs--;
+    }
+  }
+  release(&c->lock);
+
+  while(empty){
+    s = empty;
+    empty = s->next;
+    kfree((void*)s);
+  }
+}
+
+// Allocate a new slab for c and return one of its objects.
+// The caller must not hold any kcache locks, since kalloc()
+// may call kmreclaim().
+static void*
+slab_grow(struct kcache *c)
+{
+  struct slab *s;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->nfree = 0;
+  for(i = c->nobj - 1; i >= 0; i--){
+    if(c->ctor)
+      c->ctor(slab_obj(c, s, i));
+    if(i > 0)
+      s->freeidx[s->nfree++] = i;
+  }
+
+  // object 0 goes to the caller.
+  acquire(&c->lock);
+  c->nslabs++;
+  if(s->nfree > 0){
+    s->next = c->partial.next;
+    s->prev = &c->partial;
+    c->partial.next->prev = s;
+    c->partial.next = s;
+  }
+  release(&c->lock);
+  return slab_obj(c, s, 0);
+}
+
+// Allocate an object from cache c.
+// Returns 0 if there is no memory for a new slab.
+void*
+kcache_alloc(struct kcache *c)
+{
+  struct magazine *m;
+  void *obj = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n == 0)
+    m->n = slab_take(c, m->obj, MAGSIZE/2);
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  release(&m->lock);
+  if(obj == 0)
+    obj = slab_grow(c);
+  pop_off();
+
+  if(obj)
+    __sync_fetch_and_add(&c->nalloc, 1);
+  return obj;
+}
+
+// Free an object returned by kcache_alloc() or kmalloc().
+// It must be in the state the cache's ctor leaves it in.
+void
+kmfree(void *obj)
+{
+  struct kcache *c;
+  struct magazine *m;
+
+  if((uint64)obj % PGSIZE == 0){
+    kfree(obj);  // from kmalloc(), too big for a cache
+    return;
+  }
+  c = ((struct slab*)PGROUNDDOWN((uint64)obj))->cache;
+  if((uint64)obj % 16 || c < kmcache.cache || c >= kmcache.cache + NKCACHE)
+    panic("kmfree");
+  __sync_fetch_and_sub(&c->nalloc, 1);
+
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n == MAGSIZE){
+    slab_put(c, &m->obj[MAGSIZE/2], MAGSIZE/2);
+    m->n = MAGSIZE/2;
+  }
+  m->obj[m->n++] = obj;
+  release(&m->lock);
+  pop_off();
+}
+
+// Allocate n bytes from a general-purpose cache, or a
+// page if n is too big for the caches.
+// Returns 0 if n is over a page or memory is short.
+void*
+kmalloc(uint n)
+{
+  for(int i = 0; i < NELEM(kmsizes); i++)
+    if(n <= kmsizes[i])
+      return kcache_alloc(kmgeneral[i]);
+  if(n <= PGSIZE)
+    return kalloc();
+  return 0;
+}
+
+// Flush every magazine back to the slabs, so that slabs
+// with no objects in use return their pages to kalloc().
+// Called by kalloc() when it runs out of pages.
+void
+kmreclaim(void)
+{
+  struct kcache *c;
+  struct magazine *m;
+  void *objs[MAGSIZE];
+  int n;
+
+  for(c = kmcache.cache; c < kmcache.cache + NKCACHE; c++){
+    if(c->size == 0)
+      continue;
+    for(m = c->mag; m < c->mag + NCPU; m++){
+      acquire(&m->lock);
+      n = m->n;
+      memmove(objs, m->obj, n * sizeof(void*));
+      m->n = 0;
+      release(&m->lock);
+      if(n > 0)
+        slab_put(c, objs, n);
+    }
+  }
+}
+
+// Fill in the slab fields of *info for sys_sysinfo(),
+// without taking any lock.
+void
+kmallocstat(struct sysinfo *info)
+{
+  struct kcache *c;
+
+  info->slabmem = 0;
+  info->slabused = 0;
+  for(c = kmcache.cache; c < kmcache.cache + NKCACHE; c++){
+    if(c->size == 0)
+      continue;
+    info->slabmem += c->nslabs * PGSIZE;
+    info->slabused += c->nalloc * c->size;
+  }
+}
@@ -3,145 +3,461 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "sysinfo.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
-// any reasoning required about whether a commit might
-// write an uncommitted system call's updates to disk.
+// calls. A transaction closes when none of its FS system calls
+// are active. Thus there is never any reasoning required about
+// whether a commit might write an uncommitted system call's
+// updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op() reserves log space for
+// MAXOPBLOCKS blocks; a call that may write more, such as
+// a big write(), uses begin_opn() instead, asking for at
+// most log_opmax() blocks. Usually begin_op() just adds to
+// the count of in-progress FS system calls and the blocks
+// they reserved, and returns. But if it thinks the log is
+// close to running out, it sleeps until the transaction
+// commits.
+//
+// The log's size comes from the superblock; mkfs -l sets it.
+//
+// Group commit: the log is double-buffered. When the last
+// end_op() closes a transaction, it copies the transaction's
+// blocks to the journal's private buffers, and new FS system
+// calls may then start a new transaction at once, changing
+// the cached blocks while the copies are committed. The
+// closing end_op() commits; if the next transaction closes
+// meanwhile, it commits that one too, so the end_op()s of
+// the next transaction don't wait. It stops there, so that
+// one system call isn't kept committing other people's
+// transactions for ever; the writeback thread, or a
+// log_sync() waiting for it, commits a transaction that
+// closed after that. log_sync() waits for the transaction
+// holding every finished FS system call to commit, without
+// holding up anyone else.
 //
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
-// Log appends are synchronous.
-
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
-struct logheader {
-  int n;
-  int block[LOGSIZE];
-};
+// The on-disk log format (see fs.h):
+//   tail record: seq and position of the oldest transaction
+//     not yet installed
+//   journal, a ring of transactions:
+//     header block, containing a checksum, a sequence number,
+//       and block #s for block A, B, C, ...
+//     block A
+//     block B
+//     ...
+//     next header block, ...
+// commit() appends a transaction's header together with its
+// blocks, in one go; the checksum and sequence number let
+// recovery stop at a transaction that a crash interrupted,
+// or at an old one from the ring's last time around.
+//
+// Committing doesn't install the blocks at their home
+// locations. The writeback thread does that later, for many
+// transactions at once, so that a block that several of them
+// logged, like a bitmap or inode block, is written home only
+// once, in its newest version. That is a checkpoint: it
+// writes the blocks home, flushes, and then moves the tail
+// record past the installed transactions, freeing their part
+// of the journal. A commit that finds the journal full
+// checkpoints first. Until a block is installed, its cached
+// buffer stays pinned, and the journal's copy of it stays in
+// memory, in the buffer for that journal position; so the
+// on-disk journal is read only during recovery.
+//
+// Ordered data: with FS_ORDERED in the superblock, or after
+// journal(JOURNAL_ORDERED), file data doesn't go through the
+// log. writei() hands its blocks to log_data() instead, which
+// pins them like log_write() but keeps them off the header.
+// When the transaction closes, its data blocks are written
+// in place, and commit() waits for them (and flushes) before
+// writing the log, so a committed inode never points at data
+// that isn't on disk; each data block is written once, not
+// twice. writei() logs the inode too, so a transaction with
+// data always has a header to commit. A data block does count
+// against the transaction's reservations, so pinned buffers
+// stay bounded. A block that is in the journal from a
+// transaction not yet installed, or in the open transaction's
+// header, is logged after all: a checkpoint or recovery would
+// otherwise write the journal's older copy over the data
+// written in place. So is a block that the open or the
+// committing transaction freed: until that free commits, a
+// crash would give the block back to the file that had it,
+// with the new file's data written over it.
+//
+// Log appends are synchronous: commit() waits for them.
+// If the disk has a write-back cache, a completed write may
+// not be on the media yet, so commit() flushes the journal,
+// and a checkpoint flushes its installs before moving the
+// tail record and the tail record before the space is
+// reused; with a write-through disk bflush() does nothing.
+
+#define NDISCARD 512 // freed blocks a transaction remembers to discard
+#define CKPTTICKS 30 // oldest a committed transaction gets before install
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int njournal;    // journal positions: blocks after the tail record
+  int max;         // most blocks a transaction may log
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks they reserved
+  int closing;     // copying the open transaction, please wait.
+  int committing;  // in commit(); a new transaction may fill meanwhile.
   int dev;
-  struct logheader lh;
+  uint64 tid;      // id of the open transaction
+  uint64 done;     // id of the newest committed transaction
+  uint seq;        // seq of the newest committed transaction
+  struct logheader lh;   // the open transaction
+  int ordered;     // file data is written in place, not logged
+
+  // the open transaction's cached buffers, pinned by
+  // log_write(), one for each block in lh.
+  struct buf *lbuf[MAXLOG];
+
+  // the open transaction's file data, pinned by log_data(),
+  // and the committing transaction's, being written in place.
+  struct buf *dbuf[MAXLOG];
+  int nd;
+  struct buf *cdata[MAXLOG];
+  int ncdata;
+
+  // the journal in memory. jbuf[p] holds what journal position
+  // p holds on disk, for the transactions not yet installed:
+  // a header, or a block as it was when its transaction
+  // closed. jpin[p] is the cached buffer such a block came
+  // from, pinned until the block is installed.
+  struct buf *jbuf[MAXLOG];
+  struct buf *jpin[MAXLOG];
+  int tail;        // position of the oldest transaction not installed
+  uint tailseq;    // its seq
+  int head;        // position for the next transaction's header
+  int used;        // journal positions from tail to head
+  int closed;      // and after head, taken by the committing transaction
+  uint oldest;     // ticks when the oldest of them committed
+  int crashing;    // log_crash(): install nothing more
+  struct buf *tailbuf;       // for writing the tail record
+  struct sleeplock ckptlock; // one checkpoint at a time
+  uint ckhome[MAXLOG];       // checkpoint(): blocks to install
+  int ckpos[MAXLOG];         // and the positions of their newest copies
+
+  // blocks freed by the open and the committing transaction,
+  // which commit() discards once the bitmap that frees them is
+  // safely on disk. in memory only: a crash just leaves them
+  // undiscarded.
+  uint discard[NDISCARD];
+  int ndiscard;
+  uint cdiscard[NDISCARD];
+  int ncdiscard;
+
+  // every block freed by the open transaction, freed[ofreed],
+  // and by the committing one, freed[!ofreed]; unlike the
+  // discard lists, these never overflow.
+  uchar freed[2][(FSSIZE+7)/8];
+  int ofreed;
+
+  // statistics
+  uint64 nops;     // FS system calls ended
+  uint64 ncommits; // transactions committed
+  uint64 nckpts;   // checkpoints
+  uint64 ninstalled; // blocks checkpoints wrote home
+  uint64 nmerged;  // logged blocks they didn't, as a newer copy existed
+  uint64 ndata;    // file data blocks written in place
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void writeback(void);
+static int undata(struct buf*);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
+  initsleeplock(&log.ckptlock, "checkpoint");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.njournal = min(log.size - 1, MAXLOG);  // the tail record takes a block
+  log.max = log.njournal - 1;  // and a transaction's header another
+  if (log.max < MAXOPBLOCKS)
+    panic("initlog: log too small");
   log.dev = dev;
+  log.tid = 1;
+  log.ordered = (sb->flags & FS_ORDERED) != 0;
+  for (int i = 0; i < log.njournal; i++) {
+    if ((log.jbuf[i] = bprivate()) == 0)
+      panic("initlog: no buffers");
+    log.jbuf[i]->dev = dev;
+  }
+  if ((log.tailbuf = bprivate()) == 0)
+    panic("initlog: no buffers");
+  log.tailbuf->dev = dev;
+  log.tailbuf->blockno = log.start;
   recover_from_log();
+  kthread("writeback", writeback);
+}
+
+// Disk block of journal position pos.
+static inline int
+jblock(int pos)
+{
+  return log.start + 1 + pos % log.njournal;
 }
 
-// Copy committed blocks from log to their home location
+// Write the tail record, saying that the oldest transaction
+// not installed has sequence number seq and starts at
+// journal position pos, and flush it to disk.
 static void
-install_trans(void)
+write_tail(uint seq, int pos)
 {
-  int tail;
+  struct logtail *lt;
+
+  acquiresleep(&log.tailbuf->lock);
+  memset(log.tailbuf->data, 0, BSIZE);
+  lt = (struct logtail *) (log.tailbuf->data);
+  lt->magic = LOGMAGIC;
+  lt->seq = seq;
+  lt->pos = pos;
+  bwrite(log.tailbuf);
+  releasesleep(&log.tailbuf->lock);
+  bflush(log.dev);
+}
+
+// Read the header of the transaction at journal position pos
+// into log.lh, and check that it is transaction seq and that
+// all of its blocks made it to disk. Returns 0 if not.
+static int
+read_trans(int pos, uint seq)
+{
+  struct logheader *lh = &log.lh;
+  struct buf *b;
+  uint sum;
+  int i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  b = bread(log.dev, jblock(pos));
+  memmove(lh, b->data, sizeof(*lh));
+  brelse(b);
+  if (lh->magic != LOGMAGIC || lh->seq != seq || lh->n <= 0 || lh->n > log.max)
+    return 0;
+  sum = logsum(LOGSUMINIT, &lh->seq, (char*)&lh->block[lh->n] - (char*)&lh->seq);
+  for (i = 0; i < lh->n; i++) {
+    b = bread(log.dev, jblock(pos+1+i));
+    sum = logsum(sum, b->data, BSIZE);
+    brelse(b);
   }
+  return sum == lh->sum;
 }
 
-// Read the log header from disk into the in-memory log header
+// Replay every whole transaction in the journal from the tail
+// on, in order, then move the tail record past them.
+// Replaying a transaction installed already is harmless.
 static void
-read_head(void)
+recover_from_log(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  struct logtail *lt;
+  struct buf *lbuf, *dbuf;
+  uint seq = 1;
+  int pos = 0, used = 0, i;
+
+  lbuf = bread(log.dev, log.start);
+  lt = (struct logtail *) (lbuf->data);
+  if (lt->magic == LOGMAGIC && lt->pos < log.njournal) {
+    seq = lt->seq;
+    pos = lt->pos;
+  }
+  brelse(lbuf);
+
+  while (used < log.njournal && read_trans(pos, seq)) {
+    for (i = 0; i < log.lh.n; i++) {
+      lbuf = bread(log.dev, jblock(pos+1+i)); // read log block
+      dbuf = bread(log.dev, log.lh.block[i]); // read dst
+      memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+      bwrite(dbuf);  // write dst to disk
+      brelse(lbuf);
+      brelse(dbuf);
+    }
+    used += 1 + log.lh.n;
+    pos = (pos + 1 + log.lh.n) % log.njournal;
+    seq++;
   }
-  brelse(buf);
+  log.lh.n = 0;
+
+  bflush(log.dev);  // installs must be on disk before the tail moves
+  write_tail(seq, pos);
+  log.seq = seq - 1;
+  log.tailseq = seq;
+  log.tail = log.head = pos;
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Install the committed transactions from the tail on at
+// their home locations, writing each block once, from the
+// newest transaction that logged it, and move the tail past
+// them.
 static void
-write_head(void)
+checkpoint(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  struct logheader *lh;
+  int pos, end, used, ntrans, nblk, ckpt, i, j, k;
+
+  acquiresleep(&log.ckptlock);
+  acquire(&log.lock);
+  pos = log.tail;
+  end = log.head;
+  used = log.used;
+  ckpt = !log.crashing;
+  release(&log.lock);
+  if (used == 0 || !ckpt) {
+    releasesleep(&log.ckptlock);
+    return;
+  }
+
+  // gather the newest copy of each block. the journal
+  // between pos and end doesn't change until the tail moves.
+  nblk = 0;
+  ntrans = 0;
+  for (k = 0; k < used; k += 1 + lh->n) {
+    lh = (struct logheader *) (log.jbuf[(pos + k) % log.njournal]->data);
+    for (i = 0; i < lh->n; i++) {
+      for (j = 0; j < nblk && log.ckhome[j] != lh->block[i]; j++)
+        ;
+      if (j == nblk)
+        nblk++;
+      else
+        log.nmerged++;
+      log.ckhome[j] = lh->block[i];
+      log.ckpos[j] = (pos + k + 1 + i) % log.njournal;
+    }
+    ntrans++;
   }
-  bwrite(buf);
-  brelse(buf);
+
+  for (j = 0; j < nblk; j++) {
+    struct buf *b = log.jbuf[log.ckpos[j]];
+    acquiresleep(&b->lock);
+    b->blockno = log.ckhome[j];
+    bwrite_async(b);  // write copy to dst
+  }
+  for (j = 0; j < nblk; j++) {
+    bwait(log.jbuf[log.ckpos[j]]);
+    releasesleep(&log.jbuf[log.ckpos[j]]->lock);
+  }
+  bflush(log.dev);  // installs must be on disk before the tail moves
+  write_tail(log.tailseq + ntrans, end);
+
+  // the cache may now forget the installed blocks.
+  for (k = 0; k < used; k += 1 + lh->n) {
+    lh = (struct logheader *) (log.jbuf[(pos + k) % log.njournal]->data);
+    for (i = 0; i < lh->n; i++)
+      bunpin(log.jpin[(pos + k + 1 + i) % log.njournal]);
+  }
+
+  acquire(&log.lock);
+  log.tail = end;
+  log.tailseq += ntrans;
+  log.used -= used;
+  log.oldest = ticks;
+  log.nckpts++;
+  log.ninstalled += nblk;
+  release(&log.lock);
+  releasesleep(&log.ckptlock);
+}
+
+// Is there a closed transaction that nobody is committing?
+// If so, the caller is to commit it. Called with log.lock.
+static int
+need_commit(void)
+{
+  if(log.committing || log.outstanding > 0 || log.lh.n == 0)
+    return 0;
+  log.committing = 1;
+  return 1;
 }
 
+// The writeback thread. Commits a transaction whose commit()
+// left it waiting. Checkpoints when the journal is half full,
+// or when its oldest transaction is CKPTTICKS old, so that
+// end_op() seldom has to.
 static void
-recover_from_log(void)
+writeback(void)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  int ckpt, cmt;
+
+  for(;;){
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    acquire(&log.lock);
+    cmt = need_commit();
+    ckpt = log.used > log.njournal / 2 ||
+           (log.used > 0 && ticks - log.oldest >= CKPTTICKS);
+    release(&log.lock);
+    if(cmt)
+      commit();
+    if(ckpt)
+      checkpoint();
+  }
 }
 
-// called at the start of each FS system call.
+// The most blocks one FS system call may reserve: half a
+// transaction, so that big writes leave room for others.
+int
+log_opmax(void)
+{
+  return log.max / 2 > MAXOPBLOCKS ? log.max / 2 : MAXOPBLOCKS;
+}
+
+// called at the start of each FS system call that
+// writes at most n blocks.
 void
-begin_op(void)
+begin_opn(int n)
 {
+  if(n < 1 || n > log_opmax())
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.closing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log.lh.n + log.nd + log.reserved + n > log.max){
+      // this op might exhaust the open transaction's
+      // log space; wait for it to commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logres = n;
       release(&log.lock);
       break;
     }
   }
 }
 
+// called at the start of each FS system call.
+void
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// unless a commit is already under way, which will
+// then commit this transaction too.
 void
 end_op(void)
 {
@@ -149,9 +465,9 @@ end_op(void)
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  log.reserved -= myproc()->logres;
+  log.nops++;
+  if(log.outstanding == 0 && !log.committing){
     do_commit = 1;
     log.committing = 1;
   } else {
@@ -166,44 +482,216 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Wait until the changes of every FS system call that has
+// finished are committed. Doesn't hold up other FS system
+// calls, and shares the commit with anyone else waiting.
+void
+log_sync(void)
+{
+  uint64 tid;
+
+  acquire(&log.lock);
+  // the open transaction holds some finished calls' changes
+  // only if it has any changes at all. while it is closing,
+  // its header is being copied, and log.tid not yet moved on.
+  tid = log.closing || log.lh.n > 0 ? log.tid : log.tid - 1;
+  while(log.done < tid){
+    if(need_commit()){
+      release(&log.lock);
+      commit();
+      acquire(&log.lock);
+    } else {
+      sleep(&log.done, &log.lock);
+    }
+  }
+  release(&log.lock);
+}
+
+// Close the open transaction: start writing its file data
+// in place, copy its header and blocks to the journal
+// buffers from log.head on, and make it the committing one.
+// Called with no FS system calls outstanding and log.closing
+// set, so nobody changes the blocks meanwhile, and with room
+// in the journal. The caller empties log.lh, under log.lock.
 static void
+close_trans(void)
+{
+  struct logheader *hdr;
+  struct buf *b, *jb;
+  int i;
+
+  // start writing the file data in place; commit() waits.
+  for (i = 0; i < log.nd; i++) {
+    b = log.dbuf[i];
+    acquiresleep(&b->lock);
+    bwrite_async(b);
+    log.cdata[i] = b;
+  }
+  log.ncdata = log.nd;
+  log.nd = 0;
+
+  jb = log.jbuf[log.head];
+  acquiresleep(&jb->lock);
+  hdr = (struct logheader *) (jb->data);
+  for (i = 0; i < log.lh.n; i++) {
+    b = log.lbuf[i];
+    jb = log.jbuf[(log.head + 1 + i) % log.njournal];
+    acquiresleep(&b->lock);
+    acquiresleep(&jb->lock);
+    memmove(jb->data, b->data, BSIZE);
+    releasesleep(&b->lock);
+    log.jpin[(log.head + 1 + i) % log.njournal] = b;
+    hdr->block[i] = log.lh.block[i];
+  }
+  hdr->n = log.lh.n;
+
+  memmove(log.cdiscard, log.discard, log.ndiscard * sizeof(uint));
+  log.ncdiscard = log.ndiscard;
+  log.ndiscard = 0;
+  log.ofreed = !log.ofreed;  // the other one is empty
+}
+
+// Write the committing transaction's header and blocks to
+// the journal, all at once. Once all are on disk, the
+// transaction has committed. Returns the journal positions
+// it took.
+static int
 write_log(void)
 {
-  int tail;
+  struct logheader *hdr;
+  struct buf *jb;
+  uint sum;
+  int i, n;
+
+  hdr = (struct logheader *) (log.jbuf[log.head]->data);
+  n = hdr->n;
+  hdr->magic = LOGMAGIC;
+  hdr->seq = log.seq + 1;
+  sum = logsum(LOGSUMINIT, &hdr->seq,
+               (char*)&hdr->block[n] - (char*)&hdr->seq);
+  for (i = 0; i < n; i++) {
+    jb = log.jbuf[(log.head + 1 + i) % log.njournal];
+    jb->blockno = jblock(log.head + 1 + i);  // log block
+    sum = logsum(sum, jb->data, BSIZE);
+    bwrite_async(jb);  // write the log
+  }
+  hdr->sum = sum;
+  jb = log.jbuf[log.head];
+  jb->blockno = jblock(log.head);
+  bwrite_async(jb);  // write the header
+
+  for (i = 0; i <= n; i++) {
+    jb = log.jbuf[(log.head + i) % log.njournal];
+    bwait(jb);
+    releasesleep(&jb->lock);
+  }
+  return 1 + n;
+}
+
+// Wait for the committing transaction's file data to reach
+// its home locations, which must happen before the
+// transaction commits, and let the cache forget the blocks.
+static void
+wait_data(void)
+{
+  struct buf *b;
+  int i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (i = 0; i < log.ncdata; i++) {
+    b = log.cdata[i];
+    bwait(b);
+    releasesleep(&b->lock);
+    bunpin(b);
   }
+  if (log.ncdata > 0)
+    bflush(log.dev);  // data must be on disk before the commit
 }
 
+// Discard the blocks the committed transaction freed,
+// sorted and merged into runs of consecutive blocks.
+static void
+discard_freed(void)
+{
+  int i, j, n;
+  uint b;
+
+  n = log.ncdiscard;
+  for(i = 1; i < n; i++){
+    b = log.cdiscard[i];
+    for(j = i; j > 0 && log.cdiscard[j-1] > b; j--)
+      log.cdiscard[j] = log.cdiscard[j-1];
+    log.cdiscard[j] = b;
+  }
+  for(i = 0; i < n; i = j){
+    for(j = i + 1; j < n && log.cdiscard[j] == log.cdiscard[j-1] + 1; j++)
+      ;
+    bdiscard(log.dev, log.cdiscard[i], j - i);
+  }
+  log.ncdiscard = 0;
+}
+
+// Commit the open transaction, and then the next one, if it
+// closes before that commit is done, but no more.
+// Called with log.committing set.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
+  uint64 tid;
+  int n, ncommit = 0;
+
+  acquire(&log.lock);
+  while (ncommit < 2 && log.outstanding == 0 && log.lh.n > 0) {
+    if (log.njournal - log.used < 1 + log.lh.n) {
+      // no room in the journal; install what's there.
+      if (log.crashing)
+        panic("log_crash: journal full");
+      release(&log.lock);
+      checkpoint();
+      acquire(&log.lock);
+      continue;
+    }
+    log.closing = 1;
+    release(&log.lock);
+    close_trans();
+    acquire(&log.lock);
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.closing = 0;
+    log.closed = 1 + ((struct logheader *) (log.jbuf[log.head]->data))->n;
+    tid = log.tid++;
+    wakeup(&log);    // the next transaction may start
+    release(&log.lock);
+
+    wait_data();     // Write file data in place
+    n = write_log(); // Write header and blocks to log -- the commit
+    bflush(log.dev);        // Commit must be on disk before log_sync() returns
+    discard_freed(); // Tell the disk about freed blocks
+
+    acquire(&log.lock);
+    if (log.used == 0)
+      log.oldest = ticks;
+    log.seq++;
+    log.head = (log.head + n) % log.njournal;
+    log.used += n;
+    log.closed = 0;
+    memset(log.freed[!log.ofreed], 0, sizeof(log.freed[0]));
+    log.done = tid;
+    log.ncommits++;
+    log.ndata += log.ncdata;
+    wakeup(&log.done);
+    ncommit++;
   }
+  log.committing = 0;
+  wakeup(&log);
+  wakeup(&log.done);  // a log_sync() may commit what's left
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit()/write_log() will write the log, checkpoint() the block.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -215,7 +703,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.max)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -227,9 +715,168 @@ log_write(struct buf *b)
   }
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
-    bpin(b);
+    if (!undata(b))
+      bpin(b);
+    log.lbuf[i] = b;
     log.lh.n++;
   }
   release(&log.lock);
 }
 
+// If b is file data of the open transaction, make it an
+// ordinary logged block, keeping its pin. Returns 1 if so.
+static int
+undata(struct buf *b)
+{
+  for (int i = 0; i < log.nd; i++) {
+    if (log.dbuf[i] == b) {
+      log.dbuf[i] = log.dbuf[--log.nd];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Is block blockno in a committed transaction not yet
+// installed, or in the committing one?
+static int
+journaled(uint blockno)
+{
+  struct logheader *lh;
+  int k, i;
+
+  for (k = 0; k < log.used + log.closed; k += 1 + lh->n) {
+    lh = (struct logheader *) (log.jbuf[(log.tail + k) % log.njournal]->data);
+    for (i = 0; i < lh->n; i++) {
+      if (lh->block[i] == blockno)
+        return 1;
+    }
+  }
+  return 0;
+}
+
+// Did the open or the committing transaction free block
+// blockno? Blocks past FSSIZE aren't tracked, so say yes.
+static int
+freedblock(uint blockno)
+{
+  if (blockno >= FSSIZE)
+    return 1;
+  return ((log.freed[0][blockno/8] | log.freed[1][blockno/8]) >>
+          (blockno%8)) & 1;
+}
+
+// Like log_write(), but for a block of file data. In ordered
+// mode, the block is written in place when the transaction
+// closes, instead of being logged.
+void
+log_data(struct buf *b)
+{
+  int i;
+
+  if (log.outstanding < 1)
+    panic("log_data outside of trans");
+
+  acquire(&log.lock);
+  if (!log.ordered)
+    goto logit;
+  for (i = 0; i < log.lh.n; i++) {
+    if (log.lh.block[i] == b->blockno)
+      goto logit;
+  }
+  for (i = 0; i < log.nd; i++) {
+    if (log.dbuf[i] == b) {  // absorption
+      release(&log.lock);
+      return;
+    }
+  }
+  if (freedblock(b->blockno) || journaled(b->blockno))
+    goto logit;
+  if (log.lh.n + log.nd >= log.max)
+    panic("too big a transaction");
+  bpin(b);
+  log.dbuf[log.nd++] = b;
+  release(&log.lock);
+  return;
+
+logit:
+  release(&log.lock);
+  log_write(b);
+}
+
+// Set the journaling mode, JOURNAL_DATA or JOURNAL_ORDERED,
+// for the transactions to come. Returns the old mode, or -1
+// if mode isn't one of them. Blocks the open transaction
+// handed to log_data() are still written in place.
+int
+log_mode(int mode)
+{
+  int old;
+
+  if (mode != JOURNAL_DATA && mode != JOURNAL_ORDERED)
+    return -1;
+  acquire(&log.lock);
+  old = log.ordered ? JOURNAL_ORDERED : JOURNAL_DATA;
+  log.ordered = mode == JOURNAL_ORDERED;
+  release(&log.lock);
+  return old;
+}
+
+
+// The current transaction frees block b. Remember to
+// discard it after commit. If the list is full, b just
+// stays on disk; discarding is only a hint. Remember that
+// it was freed in any case, for log_data().
+void
+log_discard(uint b)
+{
+  acquire(&log.lock);
+  if(log.ndiscard < NDISCARD)
+    log.discard[log.ndiscard++] = b;
+  if(b < FSSIZE)
+    log.freed[log.ofreed][b/8] |= 1 << (b%8);
+  release(&log.lock);
+}
+
+// The current transaction allocates block b, which it
+// may have freed earlier; don't discard it after all.
+void
+log_undiscard(uint b)
+{
+  acquire(&log.lock);
+  for(int i = 0; i < log.ndiscard; i++){
+    if(log.discard[i] == b){
+      log.discard[i] = log.discard[--log.ndiscard];
+      break;
+    }
+  }
+  release(&log.lock);
+}
+
+// For testing recovery: install every committed transaction,
+// then stop installing, as if the machine were about to
+// crash. Transactions still commit to the journal, so the
+// next boot has to replay them. There is no going back.
+// Only sys_logcrash() calls this, in a LOGCRASH build.
+void
+log_crash(void)
+{
+  checkpoint();
+  acquire(&log.lock);
+  log.crashing = 1;
+  release(&log.lock);
+}
+
+// Fill in the log fields of *info for sys_sysinfo().
+void
+logstat(struct sysinfo *info)
+{
+  info->logops = log.nops;
+  info->logcommits = log.ncommits;
+  info->logsize = log.max;
+  info->logckpts = log.nckpts;
+  info->loginstalled = log.ninstalled;
+  info->logmerged = log.nmerged;
+  info->journal = log.ordered ? JOURNAL_ORDERED : JOURNAL_DATA;
+  info->logdata = log.ndata;
+}
@@ -11,12 +11,23 @@ void
 main()
 {
   if(cpuid() == 0){
+#ifdef BOOTTIME
+    uint64 t0, t1;
+#endif
+
     consoleinit();
     printfinit();
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
+#ifdef BOOTTIME
+    t0 = mtime();
+#endif
     kinit();         // physical page allocator
+#ifdef BOOTTIME
+    t1 = mtime();
+#endif
+    kmallocinit();   // slab caches for small objects
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
@@ -27,8 +38,14 @@ main()
     binit();         // buffer cache
     iinit();         // inode cache
     fileinit();      // file table
+    pipeinit();      // pipe cache
     virtio_disk_init(); // emulated hard disk
+    ramdiskinit();   // ramdisk and null block devices
     userinit();      // first user process
+#ifdef BOOTTIME
+    printf("boot: kinit %d us, kernel ready %d us after reset\n",
+           (int)((t1 - t0) / 10), (int)(mtime() / 10));
+#endif
     __sync_synchronize();
     started = 1;
   } else {
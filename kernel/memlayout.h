@@ -30,6 +30,14 @@
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
+// the CLINT's mtime counter, which starts at 0 at reset
+// and ticks at 10MHz on qemu's virt machine.
+static inline uint64
+mtime(void)
+{
+  return *(volatile uint64*)CLINT_MTIME;
+}
+
 // qemu puts programmable interrupt controller here.
 #define PLIC 0x0c000000L
 #define PLIC_PRIORITY (PLIC + 0x0)
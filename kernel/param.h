@@ -4,10 +4,17 @@
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
-#define ROOTDEV       1  // device number of file system root disk
+#define NBDEV         4  // maximum block device number
+#define VIRTIODEV     1  // block device: the virtio disk
+#define RAMDEV        2  // block device: ramdisk, a copy of the virtio disk
+#define NULLDEV       3  // block device: stores nothing, completes at once
+#ifndef ROOTDEV
+#define ROOTDEV       VIRTIODEV  // device number of file system root disk
+#endif
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGSIZE      64  // blocks in on-disk log, by default; see mkfs -l
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER     9     // largest kalloc_order() block is 2^9 pages (2MB)
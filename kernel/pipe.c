@@ -19,6 +19,25 @@ struct pipe {
   int writeopen;  // write fd is still open
 };
 
+// pipes come from their own slab cache, several to a page.
+struct kcache *pipecache;
+
+// Constructor for pipe objects; the lock stays
+// initialized while a pipe sits free in the cache.
+static void
+pipector(void *obj)
+{
+  struct pipe *pi = obj;
+
+  initlock(&pi->lock, "pipe");
+}
+
+void
+pipeinit(void)
+{
+  pipecache = kcache_create("pipe", sizeof(struct pipe), pipector);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,13 +47,12 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)kcache_alloc(pipecache)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
-  initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -47,7 +65,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmfree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,7 +86,7 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    kmfree(pi);
   } else
     release(&pi->lock);
 }
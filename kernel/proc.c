@@ -503,7 +503,10 @@ scheduler(void)
     }
     if(found == 0) {
       intr_on();
-      asm volatile("wfi");
+      // nothing to run: zero a free page for kalloc_zeroed(),
+      // or wait for an interrupt if there is nothing to zero.
+      if(kzeroidle() == 0)
+        asm volatile("wfi");
     }
   }
 }
@@ -567,6 +570,45 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  myproc()->kfn();
+  panic("kthread returned");
+}
+
+// Start a kernel thread that runs fn(), which must not
+// return. It never goes to user space, so it has no user
+// page table or trapframe, and it has no pid, so that it
+// doesn't change the pids user processes get.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  for(p = proc; p < &proc[NPROC]; p++) {
+    acquire(&p->lock);
+    if(p->state == UNUSED)
+      break;
+    release(&p->lock);
+  }
+  if(p == &proc[NPROC])
+    panic("kthread");
+
+  memset(&p->context, 0, sizeof(p->context));
+  p->context.ra = (uint64)kthreadret;
+  p->context.sp = p->kstack + PGSIZE;
+  p->kfn = fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -639,7 +681,7 @@ kill(int pid)
 
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
-    if(p->pid == pid){
+    if(p->pid == pid && pid > 0){  // kernel threads have no pid
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
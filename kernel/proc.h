@@ -105,4 +105,6 @@ struct proc {
   char name[16];               // Process name (debugging)
 
   int mask;					   // for trace syscall
+  int logres;                  // log blocks reserved by the FS call in progress
+  void (*kfn)(void);           // what a kernel thread runs
 };
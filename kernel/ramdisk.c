@@ -1,5 +1,17 @@
 //
-// ramdisk that uses the disk image loaded by qemu -initrd fs.img
+// memory-backed block devices.
+//
+// the ramdisk keeps FSSIZE blocks in memory. a block that
+// has never been written is read from the virtio disk the
+// first time it is needed, so the ramdisk starts out as a
+// copy of fs.img, and writes never reach fs.img.
+//
+// the null device moves no data: reads return zeros and
+// writes are thrown away. it can't hold a file system; it
+// is there to time the block layer without any device.
+//
+// both complete every request before returning, so starting
+// a request and waiting for it are the same thing.
 //
 
 #include "types.h"
@@ -12,34 +24,130 @@
 #include "fs.h"
 #include "buf.h"
 
-void
-ramdiskinit(void)
+static struct {
+  struct spinlock lock;
+  char *data;                   // FSSIZE blocks, allocated on first use
+  uchar loaded[(FSSIZE+7)/8];   // bit set once a block is in data
+} ramdisk;
+
+// Tell the block layer that b is done, as a
+// driver's interrupt handler would.
+static void
+done(struct buf *b)
 {
+  b->disk = 0;
+  if(b->iodone){
+    void (*iodone)(struct buf*) = b->iodone;
+    b->iodone = 0;
+    iodone(b);
+  }
 }
 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-ramdiskrw(struct buf *b)
+// Return the memory holding block blockno, and
+// whether it has been loaded.
+static char*
+ramdisk_block(uint blockno, int *loaded)
 {
-  if(!holdingsleep(&b->lock))
-    panic("ramdiskrw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("ramdiskrw: nothing to do");
+  int order;
+
+  if(blockno >= FSSIZE)
+    panic("ramdisk: blockno too big");
+
+  acquire(&ramdisk.lock);
+  if(ramdisk.data == 0){
+    for(order = 0; (PGSIZE << order) < FSSIZE * BSIZE; order++)
+      ;
+    if((ramdisk.data = kalloc_order(order)) == 0)
+      panic("ramdisk: no memory");
+  }
+  *loaded = ramdisk.loaded[blockno/8] & (1 << (blockno%8));
+  ramdisk.loaded[blockno/8] |= 1 << (blockno%8);
+  release(&ramdisk.lock);
+  return ramdisk.data + (uint64)blockno * BSIZE;
+}
 
-  if(b->blockno >= FSSIZE)
-    panic("ramdiskrw: blockno too big");
+static void
+ramdisk_rw(struct buf *b, int write)
+{
+  char *addr;
+  int loaded;
+  void (*iodone)(struct buf*);
 
-  uint64 diskaddr = b->blockno * BSIZE;
-  char *addr = (char *)RAMDISK + diskaddr;
+  if(!holdingsleep(&b->lock))
+    panic("ramdisk_rw: buf not locked");
 
-  if(b->flags & B_DIRTY){
-    // write
+  addr = ramdisk_block(b->blockno, &loaded);
+  if(write){
     memmove(addr, b->data, BSIZE);
-    b->flags &= ~B_DIRTY;
-  } else {
-    // read
+  } else if(loaded){
     memmove(b->data, addr, BSIZE);
-    b->flags |= B_VALID;
+  } else {
+    // first use of this block: fetch it from fs.img. the buf
+    // lock keeps anyone else from using the block meanwhile.
+    // virtio_disk_rw() needs a buf with no b->iodone, or the
+    // callback would run in place of its wakeup; done() runs
+    // it once we are finished.
+    iodone = b->iodone;
+    b->iodone = 0;
+    virtio_disk_rw(b, 0);
+    b->iodone = iodone;
+    memmove(addr, b->data, BSIZE);
   }
 }
+
+static void
+ramdisk_start(struct buf *b, int write)
+{
+  ramdisk_rw(b, write);
+  done(b);
+}
+
+static void
+null_rw(struct buf *b, int write)
+{
+  if(!write)
+    memset(b->data, 0, BSIZE);
+}
+
+static void
+null_start(struct buf *b, int write)
+{
+  null_rw(b, write);
+  done(b);
+}
+
+// requests are finished before start() returns.
+static void
+mem_wait(struct buf *b)
+{
+}
+
+static void
+mem_nop(void)
+{
+}
+
+static void
+mem_discard(uint blockno, uint n)
+{
+}
+
+void
+ramdiskinit(void)
+{
+  initlock(&ramdisk.lock, "ramdisk");
+
+  bdevsw[RAMDEV].rw = ramdisk_rw;
+  bdevsw[RAMDEV].start = ramdisk_start;
+  bdevsw[RAMDEV].wait = mem_wait;
+  bdevsw[RAMDEV].kick = mem_nop;
+  bdevsw[RAMDEV].flush = mem_nop;
+  bdevsw[RAMDEV].discard = mem_discard;
+
+  bdevsw[NULLDEV].rw = null_rw;
+  bdevsw[NULLDEV].start = null_start;
+  bdevsw[NULLDEV].wait = mem_wait;
+  bdevsw[NULLDEV].kick = mem_nop;
+  bdevsw[NULLDEV].flush = mem_nop;
+  bdevsw[NULLDEV].discard = mem_discard;
+}
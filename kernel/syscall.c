@@ -106,6 +106,14 @@ extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
 extern uint64 sys_trace(void);
 extern uint64 sys_sysinfo(void);
+extern uint64 sys_iosched(void);
+extern uint64 sys_diskpoll(void);
+extern uint64 sys_sync(void);
+extern uint64 sys_journal(void);
+extern uint64 sys_bdevrw(void);
+#ifdef LOGCRASH
+extern uint64 sys_logcrash(void);
+#endif
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -131,6 +139,14 @@ static uint64 (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_trace]   sys_trace,
 [SYS_sysinfo] sys_sysinfo,
+[SYS_iosched] sys_iosched,
+[SYS_diskpoll] sys_diskpoll,
+[SYS_sync]    sys_sync,
+[SYS_journal] sys_journal,
+[SYS_bdevrw]  sys_bdevrw,
+#ifdef LOGCRASH
+[SYS_logcrash] sys_logcrash,
+#endif
 };
 
 char *sysNum2Name[] = {
@@ -138,7 +154,8 @@ char *sysNum2Name[] = {
 	"kill", "exec", "fstat", "chdir", "dup",
 	"getpid", "sbrk", "sleep", "uptime", "open",
 	"write", "mknod", "unlink", "link", "mkdir",
-	"close", "trace", "sysinfo",
+	"close", "trace", "sysinfo", "iosched",
+	"diskpoll", "sync", "journal", "bdevrw", "logcrash",
 };
 
 void
@@ -22,3 +22,9 @@
 #define SYS_close   21
 #define SYS_trace   22
 #define SYS_sysinfo 23
+#define SYS_iosched 24
+#define SYS_diskpoll 25
+#define SYS_sync 26
+#define SYS_journal 27
+#define SYS_bdevrw 28
+#define SYS_logcrash 29
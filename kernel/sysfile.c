@@ -13,6 +13,7 @@
 #include "proc.h"
 #include "fs.h"
 #include "sleeplock.h"
+#include "buf.h"
 #include "file.h"
 #include "fcntl.h"
 
@@ -484,3 +485,60 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// wait until the effects of every finished file system
+// call are on disk.
+uint64
+sys_sync(void)
+{
+  log_sync();
+  return 0;
+}
+
+#ifdef LOGCRASH
+// stop installing committed transactions, so that the next
+// boot must replay them; for logtest. only in a LOGCRASH
+// build: the journal soon fills, and then the kernel panics.
+uint64
+sys_logcrash(void)
+{
+  log_crash();
+  return 0;
+}
+#endif
+
+// read or write block blockno of block device dev through
+// the buffer cache, to exercise the block devices. a read
+// also starts reading the next block ahead, as readi() does.
+// the root device belongs to the file system, so writing it
+// is refused.
+uint64
+sys_bdevrw(void)
+{
+  int dev, blockno, write;
+  uint64 addr;
+  struct buf *b;
+  int r;
+
+  if(argint(0, &dev) < 0 || argint(1, &blockno) < 0 ||
+     argaddr(2, &addr) < 0 || argint(3, &write) < 0)
+    return -1;
+  if(dev < 1 || dev >= NBDEV || bdevsw[dev].rw == 0 ||
+     blockno < 0 || blockno >= FSSIZE)
+    return -1;
+  if(write && dev == ROOTDEV)
+    return -1;
+
+  b = bread(dev, blockno);
+  if(write){
+    r = copyin(myproc()->pagetable, (char*)b->data, addr, BSIZE);
+    if(r == 0)
+      bwrite(b);
+  } else {
+    r = copyout(myproc()->pagetable, addr, (char*)b->data, BSIZE);
+  }
+  brelse(b);
+  if(!write && blockno + 1 < FSSIZE)
+    breadahead(dev, blockno + 1);
+  return r;
+}
@@ -1,4 +1,46 @@
+// I/O scheduler policies, for iosched().
+#define IOSCHED_NOOP     0  // arrival order
+#define IOSCHED_DEADLINE 1  // sorted by block, with deadlines
+
+// Journaling modes, for journal().
+#define JOURNAL_DATA     0  // file data goes through the log
+#define JOURNAL_ORDERED  1  // file data is written in place before commit
+
 struct sysinfo {
   uint64 freemem;   // amount of free memory (bytes)
   uint64 nproc;     // number of process
+  uint64 totalmem;  // amount of memory managed by kalloc (bytes)
+  uint64 cpufree[8];  // free pages cached by each hart; at least NCPU
+  uint64 freeblocks[10];  // free 2^k-page blocks, k = 0..MAXORDER at least
+  uint64 zeromem;   // free memory already zeroed by idle harts (bytes)
+  uint64 slabmem;   // memory in pages owned by slab caches (bytes)
+  uint64 slabused;  // memory in slab objects that are in use (bytes)
+  uint64 nbuf;      // buffers in the disk block cache
+  uint64 bhits;     // block reads found in the cache
+  uint64 bmisses;   // block reads that waited for the disk
+  uint64 rastarted; // blocks read ahead
+  uint64 rahits;    // block reads satisfied by a read-ahead block
+  uint64 diskreqs;  // requests sent to the disk
+  uint64 diskblocks; // blocks those requests moved
+  uint64 disknotify; // times the disk was told of new requests
+  uint64 diskintr;  // disk interrupts
+  uint64 diskqueues; // disk virtqueues, one per hart at most
+  uint64 diskdone;  // requests the disk completed
+  uint64 diskflush; // cache flushes sent to the disk
+  uint64 diskdiscard; // blocks discarded
+  uint64 disklat[12];  // synchronous disk waits: [k] waited 2^k..2^(k+1) us
+  uint64 diskpolllat[12];  // the same, in polled mode
+  uint64 iosched;   // I/O scheduler policy, IOSCHED_*
+  uint64 ioqueued;  // blocks given to the I/O scheduler
+  uint64 iomerged;  // blocks it merged into a queued request
+  uint64 iodispatched; // requests it sent to the disk
+  uint64 ioseek;    // total distance in blocks between those requests
+  uint64 logops;    // FS system calls ended
+  uint64 logcommits; // log transactions committed
+  uint64 logsize;   // most blocks a log transaction may hold
+  uint64 logckpts;  // checkpoints, installing committed transactions
+  uint64 loginstalled; // blocks they wrote to their home locations
+  uint64 logmerged; // logged blocks they skipped for a newer copy
+  uint64 journal;   // journaling mode, JOURNAL_*
+  uint64 logdata;   // file data blocks written in place, not logged
 };
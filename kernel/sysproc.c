@@ -119,7 +119,11 @@ sys_sysinfo(void) {
 	
 	// fill in struct sysinfo
 	struct sysinfo info;
-	info.freemem = numFreeMem();
+	kmemstat(&info);
+	kmallocstat(&info);
+	bstat(&info);
+	virtio_disk_stat(&info);
+	logstat(&info);
 	info.nproc = num_not_unused_proc();
 
 	// copy sysinfo to user memory
@@ -128,3 +132,33 @@ sys_sysinfo(void) {
 
 	return 0;
 }
+
+uint64
+sys_iosched(void) {
+	// set the disk's I/O scheduler policy, return the old one
+	int policy;
+	if (argint(0, &policy) < 0)
+		return -1;
+
+	return virtio_disk_sched(policy);
+}
+
+uint64
+sys_diskpoll(void) {
+	// set the disk's polling budget in microseconds, return the old one
+	int us;
+	if (argint(0, &us) < 0)
+		return -1;
+
+	return virtio_disk_poll(us);
+}
+
+uint64
+sys_journal(void) {
+	// set the file system's journaling mode, return the old one
+	int mode;
+	if (argint(0, &mode) < 0)
+		return -1;
+
+	return log_mode(mode);
+}
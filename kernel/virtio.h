@@ -27,6 +27,7 @@
 #define VIRTIO_MMIO_INTERRUPT_STATUS	0x060 // read-only
 #define VIRTIO_MMIO_INTERRUPT_ACK	0x064 // write-only
 #define VIRTIO_MMIO_STATUS		0x070 // read/write
+#define VIRTIO_MMIO_CONFIG		0x100 // device-specific configuration
 
 // status register bits, from qemu virtio_config.h
 #define VIRTIO_CONFIG_S_ACKNOWLEDGE	1
@@ -37,15 +38,23 @@
 // device feature bits
 #define VIRTIO_BLK_F_RO              5	/* Disk is read-only */
 #define VIRTIO_BLK_F_SCSI            7	/* Supports scsi command passthru */
+#define VIRTIO_BLK_F_FLUSH           9	/* Cache flush command support */
 #define VIRTIO_BLK_F_CONFIG_WCE     11	/* Writeback mode available in config */
 #define VIRTIO_BLK_F_MQ             12	/* support more than one vq */
+#define VIRTIO_BLK_F_DISCARD        13	/* Discard command support */
 #define VIRTIO_F_ANY_LAYOUT         27
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
-// this many virtio descriptors.
+// offsets in the virtio-blk configuration space
+#define VIRTIO_BLK_CONFIG_WRITEBACK  32  // uint8, with VIRTIO_BLK_F_CONFIG_WCE
+#define VIRTIO_BLK_CONFIG_NUM_QUEUES 34  // uint16, with VIRTIO_BLK_F_MQ
+#define VIRTIO_BLK_CONFIG_MAX_DISCARD 36 // uint32 sectors, with VIRTIO_BLK_F_DISCARD
+
+// at most this many virtio descriptors per queue; the driver
+// uses the largest power of two the device allows, up to NUM.
 // must be a power of two.
-#define NUM 8
+#define NUM 256
 
 struct VRingDesc {
   uint64 addr;
@@ -64,9 +73,27 @@ struct VRingUsedElem {
 // for disk ops
 #define VIRTIO_BLK_T_IN  0 // read the disk
 #define VIRTIO_BLK_T_OUT 1 // write the disk
+#define VIRTIO_BLK_T_FLUSH 4 // write the disk's cache to the media
+#define VIRTIO_BLK_T_DISCARD 11 // forget a range of sectors
+
+// the format of the first descriptor in a disk request.
+// to be followed by two more descriptors containing
+// the block, and a one-byte status.
+struct virtio_blk_outhdr {
+  uint32 type; // VIRTIO_BLK_T_IN or ..._OUT
+  uint32 reserved;
+  uint64 sector;
+};
+
+// the data of a discard request: a range of sectors.
+struct virtio_blk_discard {
+  uint64 sector;
+  uint32 num_sectors;
+  uint32 flags;
+};
 
 struct UsedArea {
   uint16 flags;
   uint16 id;
-  struct VRingUsedElem elems[NUM];
+  struct VRingUsedElem elems[];  // one per descriptor
 };
@@ -16,23 +16,55 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "sysinfo.h"
+#include "iosched.h"
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
-static struct disk {
- // memory for virtio descriptors &c for queue 0.
- // this is a global instead of allocated because it must
- // be multiple contiguous pages, which kalloc()
- // doesn't support, and page aligned.
-  char pages[2*PGSIZE];
+#define MAXSEG 32  // most blocks in one disk request
+#define NLAT   12  // latency histogram buckets, log2 microseconds
+#define MAXPOLL 1000  // longest polling budget, in microseconds
+
+// one virtqueue, with its own lock, I/O scheduler queue and
+// statistics. with VIRTIO_BLK_F_MQ there is one per hart.
+struct vq {
+  struct spinlock lock;
+  int id;          // queue number, for QUEUE_SEL and QUEUE_NOTIFY
+
+  // memory for virtio descriptors &c.
+  // multiple contiguous, page-aligned pages from kalloc_order(),
+  // since the ring is sized at run time.
+  char *pages;
+  int num;         // descriptors in the ring, a power of two <= NUM
   struct VRingDesc *desc;
   uint16 *avail;
   struct UsedArea *used;
 
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
-  uint16 used_idx; // we've looked this far in used[2..NUM].
+  uint16 freeidx[NUM]; // stack of free descriptor indices
+  int nfree;
+  uint16 used_idx; // we've looked this far in used[2..num].
+  uint16 notified; // avail[1] when we last wrote QUEUE_NOTIFY
+
+  // with VIRTIO_RING_F_EVENT_IDX, the device only wants a
+  // notification once avail[1] passes *avail_event, and we
+  // only want an interrupt once used->id passes *used_event.
+  uint16 *used_event;   // after avail[], written by us
+  uint16 *avail_event;  // after used->elems[], written by the device
+
+  // statistics
+  uint64 nreq;     // requests submitted
+  uint64 nblock;   // blocks they carried
+  uint64 nnotify;  // QUEUE_NOTIFY writes
+  uint64 ndone;    // requests completed, not counting flushes
+                   // and discards
+  uint64 nflush;   // flush requests
+  uint64 ndiscard; // blocks discarded
+  // synchronous waits, by log2 of microseconds waited;
+  // lat[0] with polling off, lat[1] with it on.
+  uint64 lat[2][NLAT];
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
@@ -40,19 +72,87 @@ static struct disk {
   struct {
     struct buf *b;
     char status;
+    char wait;     // a flush or discard, which its sender waits for
   } info[NUM];
-  
-  struct spinlock vdisk_lock;
-  
-} __attribute__ ((aligned (PGSIZE))) disk;
+
+  // disk command headers.
+  // one-for-one with descriptors, for convenience.
+  // they live here rather than on the submitter's stack
+  // because an asynchronous request outlives its caller.
+  struct virtio_blk_outhdr ops[NUM];
+
+  // ranges for discard requests, also indexed by first descriptor.
+  struct virtio_blk_discard dranges[NUM];
+
+  // requests started but not yet in the ring.
+  // the I/O scheduler merges and orders them.
+  struct ioqueue q;
+};
+
+static struct disk {
+  int nq;          // queues in use
+  int eventidx;    // negotiated VIRTIO_RING_F_EVENT_IDX?
+  int writeback;   // may the device cache writes? then we must flush
+  uint maxdiscard; // most blocks in a discard; 0 if it can't
+  int pollus;      // polled mode: spin this long before sleeping
+  uint64 nintr;    // interrupts
+  struct vq vq[NCPU];
+} disk;
+
+// Set up virtqueue id.
+static void
+vq_init(struct vq *vq, int id)
+{
+  initlock(&vq->lock, "virtio_disk");
+  vq->id = id;
+
+  *R(VIRTIO_MMIO_QUEUE_SEL) = id;
+  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+  if(max == 0)
+    panic("virtio disk has no queue");
+  for(vq->num = NUM; vq->num > max; vq->num /= 2)
+    ;
+  if(vq->num < 8)
+    panic("virtio disk max queue too short");
+
+  // desc = pages -- num * VRingDesc
+  // avail = pages + num * VRingDesc -- 2 * uint16, then num * uint16,
+  //   then used_event
+  // used = next page boundary -- 2 * uint16, then num * vRingUsedElem,
+  //   then avail_event
+  uint64 usedoff = PGROUNDUP(vq->num*sizeof(struct VRingDesc) +
+                             (3+vq->num)*sizeof(uint16));
+  uint64 size = usedoff + 3*sizeof(uint16) +
+                vq->num*sizeof(struct VRingUsedElem);
+  int order = 0;
+  while((PGSIZE << order) < size)
+    order++;
+  if((vq->pages = kalloc_order(order)) == 0)
+    panic("virtio disk ring");
+  memset(vq->pages, 0, PGSIZE << order);
+
+  *R(VIRTIO_MMIO_QUEUE_NUM) = vq->num;
+  *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)vq->pages) >> PGSHIFT;
+
+  vq->desc = (struct VRingDesc *) vq->pages;
+  vq->avail = (uint16*)(((char*)vq->desc) + vq->num*sizeof(struct VRingDesc));
+  vq->used = (struct UsedArea *) (vq->pages + usedoff);
+  vq->used_event = &vq->avail[2 + vq->num];
+  vq->avail_event = (uint16*) &vq->used->elems[vq->num];
+
+  for(int i = 0; i < vq->num; i++){
+    vq->free[i] = 1;
+    vq->freeidx[i] = i;
+  }
+  vq->nfree = vq->num;
+  ioq_init(&vq->q, vq->num - 2 < MAXSEG ? vq->num - 2 : MAXSEG);
+}
 
 void
 virtio_disk_init(void)
 {
   uint32 status = 0;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
-
   if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
      *R(VIRTIO_MMIO_VERSION) != 1 ||
      *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
@@ -70,201 +170,578 @@ virtio_disk_init(void)
   uint64 features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
-  features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
-  features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk.eventidx = (features >> VIRTIO_RING_F_EVENT_IDX) & 1;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
   *R(VIRTIO_MMIO_STATUS) = status;
 
+  // with FLUSH, the device may complete a write while it is
+  // still only in its cache; we issue flushes where order on
+  // the media matters. with CONFIG_WCE we can ask for caching.
+  // without FLUSH, writes are on the media when they complete.
+  if(features & (1 << VIRTIO_BLK_F_FLUSH)){
+    volatile uint8 *wce = (uint8*)(VIRTIO0 + VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CONFIG_WRITEBACK);
+    if(features & (1 << VIRTIO_BLK_F_CONFIG_WCE))
+      *wce = 1;
+    disk.writeback = 1;
+  }
+
+  if(features & (1 << VIRTIO_BLK_F_DISCARD)){
+    disk.maxdiscard = *(volatile uint32 *)(VIRTIO0 + VIRTIO_MMIO_CONFIG +
+                                           VIRTIO_BLK_CONFIG_MAX_DISCARD) / (BSIZE / 512);
+  }
+
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
   *R(VIRTIO_MMIO_STATUS) = status;
 
   *R(VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
 
-  // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
-  if(max == 0)
-    panic("virtio disk has no queue 0");
-  if(max < NUM)
-    panic("virtio disk max queue too short");
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-  memset(disk.pages, 0, sizeof(disk.pages));
-  *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
-
-  // desc = pages -- num * VRingDesc
-  // avail = pages + 0x40 -- 2 * uint16, then num * uint16
-  // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
+  // one queue per hart, if the device has that many.
+  disk.nq = 1;
+  if(features & (1 << VIRTIO_BLK_F_MQ))
+    disk.nq = *(volatile uint16 *)(VIRTIO0 + VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CONFIG_NUM_QUEUES);
+  if(disk.nq > NCPU)
+    disk.nq = NCPU;
+  if(disk.nq < 1)
+    disk.nq = 1;
+  for(int i = 0; i < disk.nq; i++)
+    vq_init(&disk.vq[i], i);
+
+  bdevsw[VIRTIODEV].rw = virtio_disk_rw;
+  bdevsw[VIRTIODEV].start = virtio_disk_start;
+  bdevsw[VIRTIODEV].wait = virtio_disk_wait;
+  bdevsw[VIRTIODEV].kick = virtio_disk_kick;
+  bdevsw[VIRTIODEV].flush = virtio_disk_flush;
+  bdevsw[VIRTIODEV].discard = virtio_disk_discard;
 
-  disk.desc = (struct VRingDesc *) disk.pages;
-  disk.avail = (uint16*)(((char*)disk.desc) + NUM*sizeof(struct VRingDesc));
-  disk.used = (struct UsedArea *) (disk.pages + PGSIZE);
+  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+}
 
-  for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
+// The queue for requests submitted on this hart.
+static struct vq*
+myvq(void)
+{
+  int id;
 
-  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+  push_off();
+  id = cpuid() % disk.nq;
+  pop_off();
+  return &disk.vq[id];
 }
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct vq *vq)
 {
-  for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
-      return i;
-    }
-  }
-  return -1;
+  int i;
+
+  if(vq->nfree == 0)
+    return -1;
+  i = vq->freeidx[--vq->nfree];
+  vq->free[i] = 0;
+  return i;
 }
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct vq *vq, int i)
 {
-  if(i >= NUM)
+  if(i >= vq->num)
     panic("virtio_disk_intr 1");
-  if(disk.free[i])
+  if(vq->free[i])
     panic("virtio_disk_intr 2");
-  disk.desc[i].addr = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  vq->desc[i].addr = 0;
+  vq->free[i] = 1;
+  vq->freeidx[vq->nfree++] = i;
+  wakeup(&vq->free[0]);
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct vq *vq, int i)
 {
   while(1){
-    free_desc(i);
-    if(disk.desc[i].flags & VRING_DESC_F_NEXT)
-      i = disk.desc[i].next;
+    free_desc(vq, i);
+    if(vq->desc[i].flags & VRING_DESC_F_NEXT)
+      i = vq->desc[i].next;
     else
       break;
   }
 }
 
+// Tell the device about requests added to vq's avail ring
+// since the last notification, unless, with EVENT_IDX, the
+// device is still working through the ring and will see
+// them anyway. Caller must hold vq->lock.
+static void
+kick(struct vq *vq)
+{
+  uint16 old = vq->notified, new = vq->avail[1];
+
+  if(old == new)
+    return;
+  vq->notified = new;
+  __sync_synchronize();
+  // the spec's vring_need_event(): did avail[1] move past
+  // the index the device asked to hear about?
+  if(disk.eventidx && (uint16)(new - *vq->avail_event - 1) >= (uint16)(new - old))
+    return;
+  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = vq->id; // value is queue number
+  vq->nnotify++;
+}
+
 static int
-alloc3_desc(int *idx)
+allocn_desc(struct vq *vq, int *idx, int n)
+{
+  if(vq->nfree < n)
+    return -1;
+  for(int i = 0; i < n; i++)
+    idx[i] = alloc_desc(vq);
+  return 0;
+}
+
+// Allocate n descriptors, waiting for the device
+// to finish with some if need be.
+static void
+getn_desc(struct vq *vq, int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
-    if(idx[i] < 0){
-      for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
-      return -1;
+  while(1){
+    if(allocn_desc(vq, idx, n) == 0) {
+      break;
     }
+    // the ring is full of requests; make sure the
+    // device has heard about them before waiting.
+    kick(vq);
+    sleep(&vq->free[0], &vq->lock);
   }
-  return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Put idx, the head of a chain, in vq's avail ring.
+static void
+publish(struct vq *vq, int idx)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  // avail[0] is flags
+  // avail[1] tells the device how far to look in avail[2...].
+  // avail[2...] are desc[] indices the device should process.
+  // we only tell device the first index in our chain of descriptors.
+  vq->avail[2 + (vq->avail[1] % vq->num)] = idx;
+  __sync_synchronize();
+  vq->avail[1] = vq->avail[1] + 1;
+}
 
-  acquire(&disk.vdisk_lock);
+// Put request r in vq's avail ring, without telling the device.
+// Caller must hold vq->lock.
+static void
+submit(struct vq *vq, struct ioreq *r)
+{
+  uint64 sector = r->first->blockno * (BSIZE / 512);
+  struct buf *b;
+  int i, n;
 
-  // the spec says that legacy block operations use three
+  // the spec says that legacy block operations use
   // descriptors: one for type/reserved/sector, one for
-  // the data, one for a 1-byte status result.
+  // each block of data, one for a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
+  // allocate the descriptors.
+  int idx[MAXSEG+2];
+  n = r->nseg + 2;
+  getn_desc(vq, idx, n);
   
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_outhdr {
-    uint32 type;
-    uint32 reserved;
-    uint64 sector;
-  } buf0;
+  struct virtio_blk_outhdr *buf0 = &vq->ops[idx[0]];
 
-  if(write)
-    buf0.type = VIRTIO_BLK_T_OUT; // write the disk
-  else
-    buf0.type = VIRTIO_BLK_T_IN; // read the disk
-  buf0.reserved = 0;
-  buf0.sector = sector;
-
-  // buf0 is on a kernel stack, which is not direct mapped,
-  // thus the call to kvmpa().
-  disk.desc[idx[0]].addr = (uint64) kvmpa((uint64) &buf0);
-  disk.desc[idx[0]].len = sizeof(buf0);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
+  if(r->write)
+    buf0->type = VIRTIO_BLK_T_OUT; // write the disk
   else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+    buf0->type = VIRTIO_BLK_T_IN; // read the disk
+  buf0->reserved = 0;
+  buf0->sector = sector;
+
+  vq->desc[idx[0]].addr = (uint64) buf0;
+  vq->desc[idx[0]].len = sizeof(struct virtio_blk_outhdr);
+  vq->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  vq->desc[idx[0]].next = idx[1];
+
+  for(i = 1, b = r->first; b; i++, b = b->qnext){
+    vq->desc[idx[i]].addr = (uint64) b->data;
+    vq->desc[idx[i]].len = BSIZE;
+    if(r->write)
+      vq->desc[idx[i]].flags = 0; // device reads b->data
+    else
+      vq->desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    vq->desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    vq->desc[idx[i]].next = idx[i+1];
+  }
 
-  disk.info[idx[0]].status = 0;
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  vq->info[idx[0]].status = 0;
+  vq->desc[idx[n-1]].addr = (uint64) &vq->info[idx[0]].status;
+  vq->desc[idx[n-1]].len = 1;
+  vq->desc[idx[n-1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  vq->desc[idx[n-1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
+  // record the bufs for virtio_disk_intr().
+  vq->info[idx[0]].b = r->first;
+
+  publish(vq, idx[0]);
+  vq->nreq++;
+  vq->nblock += r->nseg;
+}
+
+// Move every started request into vq's ring,
+// and tell the device about them.
+// Caller must hold vq->lock.
+static void
+notify(struct vq *vq)
+{
+  struct ioreq r;
+
+  while(ioq_next(&vq->q, &r))
+    submit(vq, &r);
+  kick(vq);
+}
+
+// Start a request to read or write b, by giving it to
+// vq's I/O scheduler. virtio_disk_intr() marks b done.
+// Caller must hold vq->lock.
+static void
+start(struct vq *vq, struct buf *b, int write)
+{
   b->disk = 1;
-  disk.info[idx[0]].b = b;
+  b->diskq = vq->id;
+  // notify() may sleep, letting others fill the queue again.
+  while(ioq_full(&vq->q))
+    notify(vq);
+  ioq_add(&vq->q, b, write);
+}
 
-  // avail[0] is flags
-  // avail[1] tells the device how far to look in avail[2...].
-  // avail[2...] are desc[] indices the device should process.
-  // we only tell device the first index in our chain of descriptors.
-  disk.avail[2 + (disk.avail[1] % NUM)] = idx[0];
-  __sync_synchronize();
-  disk.avail[1] = disk.avail[1] + 1;
+// Complete the requests the device has finished with.
+// Caller must hold vq->lock.
+static void
+reap(struct vq *vq)
+{
+again:
+  while(vq->used_idx != vq->used->id){
+    __sync_synchronize();
+    int id = vq->used->elems[vq->used_idx % vq->num].id;
+    struct buf *b, *next;
+
+    if(vq->info[id].status != 0)
+      panic("virtio_disk_intr status");
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+    b = vq->info[id].b;
+    vq->info[id].b = 0;
+    if(vq->info[id].wait){
+      vq->info[id].wait = 0;
+      wakeup(&vq->info[id]);
+    } else {
+      vq->ndone++;
+    }
+    free_chain(vq, id);
+
+    for(; b; b = next){
+      next = b->qnext;
+      b->disk = 0;   // disk is done with buf
+      if(b->iodone){
+        // clear it first, since the callback may
+        // release b for reuse.
+        void (*iodone)(struct buf*) = b->iodone;
+        b->iodone = 0;
+        iodone(b);
+      } else {
+        wakeup(b);
+      }
+    }
 
-  // Wait for virtio_disk_intr() to say request has finished.
+    vq->used_idx += 1;
+  }
+
+  if(disk.eventidx){
+    // ask for an interrupt at the next completion; completions
+    // that come in before we've handled that one share it.
+    // recheck in case one came in before the device saw this.
+    *vq->used_event = vq->used_idx;
+    __sync_synchronize();
+    if(vq->used_idx != vq->used->id)
+      goto again;
+  }
+}
+
+// Wait for the disk to finish with b. In polled mode, first
+// spin on the used ring for up to disk.pollus microseconds,
+// which is quicker than sleeping for a request that is
+// about to complete. Records the wait in vq->lat[].
+// Caller must hold vq->lock; it is released while waiting.
+static void
+waitfor(struct vq *vq, struct buf *b)
+{
+  uint64 t0, t1, us;
+  int polled, k;
+
+  t0 = mtime();
+  polled = disk.pollus > 0;
+  while(b->disk == 1 && polled && mtime() - t0 < disk.pollus * 10){
+    // spin without the lock, so that other processes can
+    // submit to this queue and the interrupt handler can reap
+    // it meanwhile; take the lock only to reap.
+    release(&vq->lock);
+    do {
+      __sync_synchronize();
+    } while(b->disk == 1 && vq->used->id == vq->used_idx &&
+            mtime() - t0 < disk.pollus * 10);
+    acquire(&vq->lock);
+    reap(vq);
+  }
   while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+    sleep(b, &vq->lock);
   }
+  t1 = mtime();
+
+  for(us = (t1 - t0) / 10, k = 0; us >= 2 && k < NLAT - 1; us >>= 1)
+    k++;
+  vq->lat[polled][k]++;
+}
+
+// Read or write b, and wait for the request to finish.
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  struct vq *vq = myvq();
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  acquire(&vq->lock);
 
-  release(&disk.vdisk_lock);
+  start(vq, b, write);
+  notify(vq);
+
+  // Wait for virtio_disk_intr() to say request has finished.
+  waitfor(vq, b);
+
+  release(&vq->lock);
 }
 
+// Start reading or writing b, and return at once.
+// When the request has finished, virtio_disk_intr() calls
+// b->iodone(b) if it is set, and otherwise wakes up
+// virtio_disk_wait(b).
+// The device may not hear of the request until the next
+// virtio_disk_kick(), virtio_disk_wait() or virtio_disk_rw()
+// on this hart, and b may share a request with other bufs.
 void
-virtio_disk_intr()
+virtio_disk_start(struct buf *b, int write)
 {
-  acquire(&disk.vdisk_lock);
+  struct vq *vq = myvq();
 
-  while((disk.used_idx % NUM) != (disk.used->id % NUM)){
-    int id = disk.used->elems[disk.used_idx].id;
+  acquire(&vq->lock);
+  start(vq, b, write);
+  release(&vq->lock);
+}
 
-    if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
-    
-    disk.info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk.info[id].b);
+// Send a request with no bufs, whose header is ops[idx[0]]
+// and whose status goes in the last of its n descriptors,
+// and wait for it. Caller must hold vq->lock.
+static void
+sendwait(struct vq *vq, int *idx, int n)
+{
+  vq->desc[idx[0]].addr = (uint64) &vq->ops[idx[0]];
+  vq->desc[idx[0]].len = sizeof(struct virtio_blk_outhdr);
+  vq->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  vq->desc[idx[0]].next = idx[1];
+
+  vq->info[idx[0]].status = 0;
+  vq->desc[idx[n-1]].addr = (uint64) &vq->info[idx[0]].status;
+  vq->desc[idx[n-1]].len = 1;
+  vq->desc[idx[n-1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  vq->desc[idx[n-1]].next = 0;
+
+  vq->info[idx[0]].b = 0;
+  vq->info[idx[0]].wait = 1;
+  publish(vq, idx[0]);
+  kick(vq);
+
+  // another request may reuse the slot before we run;
+  // then we wait for that one too, which is harmless.
+  while(vq->info[idx[0]].wait)
+    sleep(&vq->info[idx[0]], &vq->lock);
+}
 
-    disk.used_idx = (disk.used_idx + 1) % NUM;
+// Make every write that has completed durable, by
+// flushing the device's write cache. Returns at once
+// if the device doesn't cache writes.
+void
+virtio_disk_flush(void)
+{
+  struct vq *vq;
+  int idx[2];
+
+  if(!disk.writeback)
+    return;
+
+  vq = myvq();
+  acquire(&vq->lock);
+  getn_desc(vq, idx, 2);
+
+  // a flush is a header and a status byte, no data.
+  struct virtio_blk_outhdr *buf0 = &vq->ops[idx[0]];
+  buf0->type = VIRTIO_BLK_T_FLUSH;
+  buf0->reserved = 0;
+  buf0->sector = 0;
+  vq->nflush++;
+  sendwait(vq, idx, 2);
+  release(&vq->lock);
+}
+
+// Tell the device that the n blocks starting at blockno
+// hold nothing worth keeping, so it can free the space
+// behind them. Does nothing if the device can't discard.
+void
+virtio_disk_discard(uint blockno, uint n)
+{
+  struct vq *vq;
+  int idx[3];
+  uint m;
+
+  if(disk.maxdiscard == 0)
+    return;
+
+  vq = myvq();
+  acquire(&vq->lock);
+  for(; n > 0; blockno += m, n -= m){
+    m = n < disk.maxdiscard ? n : disk.maxdiscard;
+    getn_desc(vq, idx, 3);
+
+    // a discard is a header, a range the device reads,
+    // and a status byte.
+    struct virtio_blk_outhdr *buf0 = &vq->ops[idx[0]];
+    buf0->type = VIRTIO_BLK_T_DISCARD;
+    buf0->reserved = 0;
+    buf0->sector = 0;
+
+    struct virtio_blk_discard *r = &vq->dranges[idx[0]];
+    r->sector = (uint64)blockno * (BSIZE / 512);
+    r->num_sectors = m * (BSIZE / 512);
+    r->flags = 0;
+    vq->desc[idx[1]].addr = (uint64) r;
+    vq->desc[idx[1]].len = sizeof(*r);
+    vq->desc[idx[1]].flags = VRING_DESC_F_NEXT; // device reads the range
+    vq->desc[idx[1]].next = idx[2];
+
+    vq->ndiscard += m;
+    sendwait(vq, idx, 3);
   }
+  release(&vq->lock);
+}
+
+// Tell the device about all requests started so far.
+void
+virtio_disk_kick(void)
+{
+  struct vq *vq;
+
+  for(vq = disk.vq; vq < disk.vq + disk.nq; vq++){
+    acquire(&vq->lock);
+    notify(vq);
+    release(&vq->lock);
+  }
+}
+
+// Wait for a request started by virtio_disk_start(b)
+// with no b->iodone to finish.
+void
+virtio_disk_wait(struct buf *b)
+{
+  // b stays in the queue it was started on, even
+  // if this process has moved to another hart.
+  struct vq *vq = &disk.vq[b->diskq];
+
+  acquire(&vq->lock);
+  if(b->disk == 1){
+    notify(vq);
+    waitfor(vq, b);
+  }
+  release(&vq->lock);
+}
+
+// There is one interrupt for all the queues, delivered to
+// whichever hart the PLIC picks, so look at all of them.
+void
+virtio_disk_intr()
+{
+  struct vq *vq;
+
+  __sync_fetch_and_add(&disk.nintr, 1);
+
+  // the device won't raise the interrupt again until we tell it
+  // we've seen this one. acknowledge before looking at the used
+  // rings, so that a completion that arrives while we're looking
+  // raises a fresh interrupt.
   *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
-  release(&disk.vdisk_lock);
+  for(vq = disk.vq; vq < disk.vq + disk.nq; vq++){
+    acquire(&vq->lock);
+    reap(vq);
+    release(&vq->lock);
+  }
+}
+
+// Fill in the disk fields of *info for sys_sysinfo(),
+// summing over the queues without locking them.
+void
+virtio_disk_stat(struct sysinfo *info)
+{
+  struct vq *vq;
+
+  info->diskreqs = info->diskblocks = info->disknotify = 0;
+  info->diskdone = info->diskflush = info->diskdiscard = 0;
+  info->diskintr = disk.nintr;
+  info->diskqueues = disk.nq;
+  for(int i = 0; i < NLAT; i++)
+    info->disklat[i] = info->diskpolllat[i] = 0;
+  info->ioqueued = info->iomerged = 0;
+  info->iodispatched = info->ioseek = 0;
+  for(vq = disk.vq; vq < disk.vq + disk.nq; vq++){
+    info->diskreqs += vq->nreq;
+    info->diskblocks += vq->nblock;
+    info->disknotify += vq->nnotify;
+    info->diskdone += vq->ndone;
+    info->diskflush += vq->nflush;
+    info->diskdiscard += vq->ndiscard;
+    for(int i = 0; i < NLAT; i++){
+      info->disklat[i] += vq->lat[0][i];
+      info->diskpolllat[i] += vq->lat[1][i];
+    }
+    ioq_stat(&vq->q, info);
+  }
+}
+
+// Set the polled mode budget, in microseconds; 0 turns
+// polled mode off. Returns the old one, or -1 if us is
+// out of range.
+int
+virtio_disk_poll(int us)
+{
+  if(us < 0 || us > MAXPOLL)
+    return -1;
+  return __sync_lock_test_and_set(&disk.pollus, us);
+}
+
+// Set the I/O scheduler policy of every queue. Returns
+// the old one, or -1 if policy isn't one.
+int
+virtio_disk_sched(int policy)
+{
+  struct vq *vq;
+  int old = -1;
+
+  for(vq = disk.vq; vq < disk.vq + disk.nq; vq++){
+    acquire(&vq->lock);
+    old = ioq_setpolicy(&vq->q, policy);
+    release(&vq->lock);
+  }
+  return old;
 }
@@ -23,6 +23,7 @@
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
 int nlog = LOGSIZE;
+int fsflags;  // FS_* flags for the superblock
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -76,8 +77,25 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  for(;;){
+    if(argc >= 3 && strcmp(argv[1], "-l") == 0){
+      nlog = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else if(argc >= 2 && strcmp(argv[1], "-o") == 0){
+      fsflags |= FS_ORDERED;
+      argc--;
+      argv++;
+    } else
+      break;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l nlog] [-o] fs.img files...\n");
+    exit(1);
+  }
+  if(nlog < 2+MAXOPBLOCKS || nlog > 1+MAXLOG){
+    fprintf(stderr, "mkfs: log must have %d to %d blocks\n",
+            2+MAXOPBLOCKS, (int)(1+MAXLOG));
     exit(1);
   }
 
@@ -102,6 +120,7 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.flags = xint(fsflags);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
          nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
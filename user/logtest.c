@@ -0,0 +1,87 @@
+// Test that boot replays the log after a crash.
+//
+// "logtest crash" writes the file logtest, has it installed,
+// then stops the kernel installing and rewrites the file, so
+// that the new contents are only in the journal, and waits to
+// be killed. "logtest check", on the next boot, checks that
+// recovery replayed the rewrite. grade-recovery runs both,
+// on a kernel built with make LOGCRASH=1.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+char *before = "before crash\n";
+char *after = "after replay\n";
+
+void
+writefile(char *data)
+{
+  int fd;
+
+  fd = open("logtest", O_CREATE | O_WRONLY);
+  if(fd < 0){
+    printf("logtest: create failed\n");
+    exit(1);
+  }
+  if(write(fd, data, strlen(data)) != strlen(data)){
+    printf("logtest: write failed\n");
+    exit(1);
+  }
+  close(fd);
+}
+
+void
+crash(void)
+{
+  // file data must go through the log to be replayed.
+  journal(JOURNAL_DATA);
+  writefile(before);
+  if(logcrash() < 0){
+    printf("logtest: FAIL: no logcrash(); build with make LOGCRASH=1\n");
+    exit(1);
+  }
+  writefile(after);
+  sync();
+  printf("logtest: crash now\n");
+  for(;;)
+    sleep(100);
+}
+
+void
+check(void)
+{
+  char buf[32];
+  int fd, n;
+
+  fd = open("logtest", O_RDONLY);
+  if(fd < 0){
+    printf("logtest: FAIL: open logtest failed\n");
+    exit(1);
+  }
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  buf[n < 0 ? 0 : n] = 0;
+  if(strcmp(buf, after) != 0){
+    printf("logtest: FAIL: logtest holds %s, log not replayed\n", buf);
+    exit(1);
+  }
+  unlink("logtest");
+  printf("logtest: replay ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc == 2 && strcmp(argv[1], "crash") == 0){
+    crash();
+  } else if(argc == 2 && strcmp(argv[1], "check") == 0){
+    check();
+  } else {
+    fprintf(2, "Usage: logtest crash|check\n");
+    exit(1);
+  }
+  exit(0);
+}
@@ -120,6 +120,71 @@ void testproc() {
   }
 }
 
+// sum of the free lists sysinfo reports.
+uint64
+freelists(struct sysinfo *info) {
+  uint64 n = info->zeromem;
+
+  for (int i = 0; i < sizeof(info->cpufree)/sizeof(info->cpufree[0]); i++)
+    n += info->cpufree[i] * PGSIZE;
+  for (int k = 0; k < sizeof(info->freeblocks)/sizeof(info->freeblocks[0]); k++)
+    n += info->freeblocks[k] * (PGSIZE << k);
+  return n;
+}
+
+void
+testcounters() {
+  struct sysinfo info;
+  int tries;
+
+  sinfo(&info);
+  if (info.totalmem < info.freemem || info.totalmem == 0) {
+    printf("FAIL: total mem %d (bytes) but free mem %d\n",
+      info.totalmem, info.freemem);
+    exit(1);
+  }
+
+  // idle harts move pages between free lists while they
+  // zero them, so give them a few chances to settle.
+  for (tries = 0; tries < 10; tries++) {
+    if (freelists(&info) == info.freemem)
+      break;
+    sleep(1);
+    sinfo(&info);
+  }
+  if (tries == 10) {
+    printf("FAIL: free lists hold %d (bytes), not %d\n",
+      freelists(&info), info.freemem);
+    exit(1);
+  }
+}
+
+void
+testslab() {
+  struct sysinfo info0, info1;
+  int fds[2];
+
+  sinfo(&info0);
+  if (pipe(fds) < 0) {
+    printf("sysinfotest: pipe failed\n");
+    exit(1);
+  }
+  sinfo(&info1);
+  if (info1.slabused < info0.slabused + 512 || info1.slabused > info1.slabmem) {
+    printf("FAIL: slab use %d of %d (bytes) with a pipe open, %d without\n",
+      info1.slabused, info1.slabmem, info0.slabused);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  sinfo(&info1);
+  if (info1.slabused != info0.slabused) {
+    printf("FAIL: slab use %d (bytes) after closing pipe instead of %d\n",
+      info1.slabused, info0.slabused);
+    exit(1);
+  }
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -127,6 +192,8 @@ main(int argc, char *argv[])
   testcall();
   testmem();
   testproc();
+  testcounters();
+  testslab();
   printf("sysinfotest: OK\n");
   exit(0);
 }
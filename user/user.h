@@ -28,6 +28,12 @@ int trace(int);
 
 struct sysinfo;
 int sysinfo(struct sysinfo *);
+int iosched(int);
+int diskpoll(int);
+int sync(void);
+int journal(int);
+int bdevrw(int, int, void*, int);
+int logcrash(void);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -2526,6 +2527,735 @@ execout(char *s)
   exit(0);
 }
 
+// ticks since t0, at least 1, to divide by.
+int
+ticksince(int t0)
+{
+  int t = uptime() - t0;
+
+  return t > 0 ? t : 1;
+}
+
+// run fn(s, i) in 1, 2 and then 4 processes at once, i
+// numbering them, where each call does n units of work, and
+// print the aggregate rate. a scalable kernel path should
+// run faster with more processes, up to the number of
+// harts; fail if the rate falls below 3/4 of one process's,
+// which leaves room for the tick clock's coarseness.
+void
+scaletest(char *s, void (*fn)(char*, int), int n, char *unit)
+{
+  int nprocs, i, t0, rate, rate1 = 0, xstatus;
+
+  for(nprocs = 1; nprocs <= 4; nprocs *= 2){
+    t0 = uptime();
+    for(i = 0; i < nprocs; i++){
+      int pid = fork();
+      if(pid < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pid == 0){
+        fn(s, i);
+        exit(0);
+      }
+    }
+    for(i = 0; i < nprocs; i++){
+      wait(&xstatus);
+      if(xstatus != 0)
+        exit(1);
+    }
+    rate = nprocs*n / ticksince(t0);
+    printf("%d procs: %d %s/tick ", nprocs, rate, unit);
+    if(nprocs == 1)
+      rate1 = rate;
+    else if(rate < rate1*3/4){
+      printf("\n%s: %d procs together %d %s/tick, one alone %d\n",
+             s, nprocs, rate, unit, rate1);
+      exit(1);
+    }
+  }
+}
+
+#define KSPAGES  64   // pages kallocwork() grows by
+#define KSROUNDS 200  // times it does
+
+void
+kallocwork(char *s, int i)
+{
+  int r;
+
+  for(r = 0; r < KSROUNDS; r++){
+    if(sbrk(KSPAGES*PGSIZE) == (char*)0xffffffffffffffffL){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    if(sbrk(-KSPAGES*PGSIZE) == (char*)0xffffffffffffffffL){
+      printf("%s: sbrk could not deallocate\n", s);
+      exit(1);
+    }
+  }
+}
+
+// allocation throughput of the physical page allocator with
+// processes growing and shrinking their memory at the same
+// time. with per-hart free lists it should scale.
+void
+kallocscale(char *s)
+{
+  scaletest(s, kallocwork, KSPAGES*KSROUNDS, "pages");
+}
+
+#define BSFILES  4    // files bcachework() reads, one per process
+#define BSBLOCKS 4    // blocks in each
+#define BSROUNDS 100  // times each is read
+
+void
+bcachework(char *s, int i)
+{
+  char file[] = "bcs0";
+  int r, fd;
+
+  file[3] = '0' + i;
+  for(r = 0; r < BSROUNDS; r++){
+    if((fd = open(file, O_RDONLY)) < 0){
+      printf("%s: open %s failed\n", s, file);
+      exit(1);
+    }
+    while(read(fd, buf, BSIZE) == BSIZE)
+      ;
+    close(fd);
+  }
+}
+
+// contention in the buffer cache: processes each re-read
+// their own small file, which stays cached, so nearly every
+// bread() is a hit. with per-bucket locks it should scale.
+void
+bcachescale(char *s)
+{
+  char file[] = "bcs0";
+  int i, j, fd;
+
+  memset(buf, 'b', BSIZE);
+  for(i = 0; i < BSFILES; i++){
+    file[3] = '0' + i;
+    fd = open(file, O_CREATE | O_RDWR);
+    if(fd < 0){
+      printf("%s: create %s failed\n", s, file);
+      exit(1);
+    }
+    for(j = 0; j < BSBLOCKS; j++){
+      if(write(fd, buf, BSIZE) != BSIZE){
+        printf("%s: write %s failed\n", s, file);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+
+  scaletest(s, bcachework, BSBLOCKS*BSROUNDS, "reads");
+
+  for(i = 0; i < BSFILES; i++){
+    file[3] = '0' + i;
+    unlink(file);
+  }
+}
+
+// create the file writetmp and make nwrite writes of n bytes
+// from p to it, filling in *before and *after with sysinfo
+// from just before and just after the writes. the caller
+// deletes the file.
+void
+writetmp(char *s, char *p, int nwrite, int n,
+         struct sysinfo *before, struct sysinfo *after)
+{
+  int fd, i;
+
+  fd = open("writetmp", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: create writetmp failed\n", s);
+    exit(1);
+  }
+  if(sysinfo(before) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < nwrite; i++){
+    if(write(fd, p, n) != n){
+      printf("%s: write writetmp failed\n", s);
+      exit(1);
+    }
+  }
+  if(sysinfo(after) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
+// writing blocks that are not cached should make the
+// buffer cache grow rather than recycle buffers.
+void
+bcachegrow(char *s)
+{
+  struct sysinfo info0, info1;
+
+  memset(buf, 'x', 512);
+  writetmp(s, buf, 64, 512, &info0, &info1);
+  unlink("writetmp");
+  if(info1.nbuf <= info0.nbuf){
+    printf("%s: buffer cache has %d buffers after writing a file, %d before\n",
+           s, info1.nbuf, info0.nbuf);
+    exit(1);
+  }
+}
+
+// the log's commit starts many disk writes before waiting,
+// so the disk should be told of them fewer times than there
+// are requests, and runs of blocks should share requests.
+void
+disknotify(char *s)
+{
+  struct sysinfo info0, info1;
+
+  memset(buf, 'y', 512);
+  writetmp(s, buf, 16, 512, &info0, &info1);
+  unlink("writetmp");
+  // cache flushes are not requests, but each may need a notification.
+  if(info1.diskreqs == info0.diskreqs ||
+     info1.disknotify - info0.disknotify >=
+     (info1.diskreqs - info0.diskreqs) + (info1.diskflush - info0.diskflush)){
+    printf("%s: %d disk requests took %d notifications\n", s,
+           info1.diskreqs - info0.diskreqs, info1.disknotify - info0.disknotify);
+    exit(1);
+  }
+  if(info1.diskqueues < 1 || info1.diskqueues > 8){
+    printf("%s: disk has %d queues\n", s, info1.diskqueues);
+    exit(1);
+  }
+  // every request sent has completed: each write waited for its commit.
+  if(info1.diskdone - info0.diskdone != info1.diskreqs - info0.diskreqs){
+    printf("%s: %d disk requests, %d completed\n", s,
+           info1.diskreqs - info0.diskreqs, info1.diskdone - info0.diskdone);
+    exit(1);
+  }
+  // the log blocks are consecutive, so they go in shared requests.
+  if(info1.diskblocks - info0.diskblocks <= info1.diskreqs - info0.diskreqs){
+    printf("%s: %d disk requests moved only %d blocks\n", s,
+           info1.diskreqs - info0.diskreqs, info1.diskblocks - info0.diskblocks);
+    exit(1);
+  }
+}
+
+// every block the disk moves passes through the I/O scheduler,
+// whichever policy is in force.
+void
+ioschedpolicy(char *s)
+{
+  struct sysinfo info0, info1;
+  int policies[] = { IOSCHED_NOOP, IOSCHED_DEADLINE };
+  int old, p;
+
+  if(iosched(-1) != -1 || iosched(99) != -1){
+    printf("%s: iosched accepted a bad policy\n", s);
+    exit(1);
+  }
+  old = iosched(IOSCHED_DEADLINE);
+  for(p = 0; p < sizeof(policies)/sizeof(policies[0]); p++){
+    iosched(policies[p]);
+    memset(buf, 'z', 512);
+    writetmp(s, buf, 8, 512, &info0, &info1);
+    unlink("writetmp");
+    if(info0.iosched != policies[p]){
+      printf("%s: iosched policy %d, expected %d\n", s, info0.iosched, policies[p]);
+      exit(1);
+    }
+    if(info1.ioqueued - info0.ioqueued != info1.diskblocks - info0.diskblocks ||
+       info1.iodispatched - info0.iodispatched != info1.diskreqs - info0.diskreqs){
+      printf("%s: scheduler queued %d blocks in %d requests, disk moved %d in %d\n", s,
+             info1.ioqueued - info0.ioqueued, info1.iodispatched - info0.iodispatched,
+             info1.diskblocks - info0.diskblocks, info1.diskreqs - info0.diskreqs);
+      exit(1);
+    }
+  }
+  iosched(old);
+}
+
+uint64
+nwaits(uint64 *lat)
+{
+  uint64 n = 0;
+
+  for(int i = 0; i < 12; i++)
+    n += lat[i];
+  return n;
+}
+
+// synchronous disk waits land in the histogram
+// for the mode they were made in.
+void
+diskpolllat(char *s)
+{
+  struct sysinfo info0, info1;
+  int old, polled;
+
+  if(diskpoll(-1) != -1){
+    printf("%s: diskpoll accepted a negative budget\n", s);
+    exit(1);
+  }
+  old = diskpoll(0);
+  for(polled = 0; polled < 2; polled++){
+    diskpoll(polled ? 100 : 0);
+    writetmp(s, "x", 1, 1, &info0, &info1);
+    unlink("writetmp");
+    if(nwaits(polled ? info1.diskpolllat : info1.disklat) ==
+       nwaits(polled ? info0.diskpolllat : info0.disklat)){
+      printf("%s: no disk waits recorded with polling %s\n", s, polled ? "on" : "off");
+      exit(1);
+    }
+  }
+  diskpoll(old);
+}
+
+// deleting a file discards its blocks, if the disk can discard.
+void
+discardfree(char *s)
+{
+  struct sysinfo info0, info1;
+
+  memset(buf, 'd', BSIZE);
+  writetmp(s, buf, 16, BSIZE, &info0, &info1);
+  unlink("writetmp");
+  // the blocks are discarded once the unlink commits.
+  if(sync() != 0 || sysinfo(&info1) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  if(info1.diskdiscard == 0)
+    return;  // disk can't discard
+  if(info1.diskdiscard - info0.diskdiscard < 16){
+    printf("%s: deleting 16 blocks discarded %d\n", s,
+           info1.diskdiscard - info0.diskdiscard);
+    exit(1);
+  }
+}
+
+// read a file that fills many blocks from start to end.
+// unless it was cached already, readahead should have
+// brought in most of its blocks before read() asked.
+void
+readahead(char *s)
+{
+  struct sysinfo info0, info1;
+  int fd;
+
+  sysinfo(&info0);
+  fd = open("usertests", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open usertests failed\n", s);
+    exit(1);
+  }
+  while(read(fd, buf, 512) > 0)
+    ;
+  close(fd);
+  sysinfo(&info1);
+  if(info1.rastarted == info0.rastarted)
+    return;  // all cached
+  if(info1.rahits == info0.rahits){
+    printf("%s: %d blocks read ahead, none used\n", s,
+           info1.rastarted - info0.rastarted);
+    exit(1);
+  }
+}
+
+// concurrent writers should share commits, and sync()
+// should return once their changes are committed.
+void
+groupcommit(char *s)
+{
+  enum { NCHILD=4, N=20 };
+  struct sysinfo info0, info1;
+  char name[] = "gc0";
+  int i, j, fd, pid, xstatus;
+
+  sysinfo(&info0);
+  for(i = 0; i < NCHILD; i++){
+    name[2] = '0' + i;
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      for(j = 0; j < N; j++){
+        fd = open(name, O_CREATE | O_RDWR);
+        if(fd < 0 || write(fd, name, sizeof(name)) != sizeof(name)){
+          printf("%s: write %s failed\n", s, name);
+          exit(1);
+        }
+        close(fd);
+        unlink(name);
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  if(sync() != 0){
+    printf("%s: sync failed\n", s);
+    exit(1);
+  }
+  sysinfo(&info1);
+  if(info1.logops - info0.logops < NCHILD * N * 4){
+    printf("%s: %d FS calls ended, expected at least %d\n", s,
+           info1.logops - info0.logops, NCHILD * N * 4);
+    exit(1);
+  }
+  if(info1.logcommits - info0.logcommits >= info1.logops - info0.logops){
+    printf("%s: %d commits for %d FS calls\n", s,
+           info1.logcommits - info0.logcommits, info1.logops - info0.logops);
+    exit(1);
+  }
+}
+
+// a big write() should go through in transactions as big
+// as the log allows, not one every few blocks.
+void
+bigtrans(char *s)
+{
+  enum { SZ=30*BSIZE };
+  struct sysinfo info0, info1;
+  char *p;
+  int nlog, chunk, nchunks, ncommits;
+
+  if((p = malloc(SZ)) == 0){
+    printf("%s: malloc failed\n", s);
+    exit(1);
+  }
+  memset(p, 0, SZ);
+  writetmp(s, p, 1, SZ, &info0, &info1);
+  unlink("writetmp");
+  free(p);
+
+  // the same arithmetic as log_opmax() and filewrite().
+  nlog = info1.logsize / 2 > MAXOPBLOCKS ? info1.logsize / 2 : MAXOPBLOCKS;
+  chunk = ((nlog - 1 - 1 - 2) / 2) * BSIZE;
+  nchunks = (SZ + chunk - 1) / chunk;
+  ncommits = info1.logcommits - info0.logcommits;
+  if(ncommits > nchunks){
+    printf("%s: %d commits for a %d-byte write, expected at most %d\n", s,
+           ncommits, SZ, nchunks);
+    exit(1);
+  }
+}
+
+// writes to the same blocks in many transactions should be
+// installed lazily, each block once for many transactions.
+void
+checkpoint(char *s)
+{
+  struct sysinfo info0, info1;
+
+  if(sysinfo(&info0) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  writetmp(s, "c", 2 * info0.logsize, 1, &info0, &info1);
+  unlink("writetmp");
+  if(info1.logckpts == info0.logckpts){
+    printf("%s: %d transactions, no checkpoint\n", s,
+           info1.logcommits - info0.logcommits);
+    exit(1);
+  }
+  if(info1.logmerged == info0.logmerged){
+    printf("%s: checkpoints installed %d blocks, merged none\n", s,
+           info1.loginstalled - info0.loginstalled);
+    exit(1);
+  }
+}
+
+// in ordered mode, file data should be written in place,
+// not logged, and should read back the same. blocks still
+// in the journal are logged even so, so first give the
+// writeback thread time to install it.
+void
+ordereddata(char *s)
+{
+  enum { NB=8 };
+  struct sysinfo info0, info1;
+  int fd, i, mode, old, ninplace[2];
+
+  if(journal(-1) != -1 || journal(99) != -1){
+    printf("%s: journal accepted a bad mode\n", s);
+    exit(1);
+  }
+  old = journal(JOURNAL_ORDERED);
+  sync();
+  sleep(40);
+  for(mode = JOURNAL_ORDERED; mode >= JOURNAL_DATA; mode--){
+    journal(mode);
+    memset(buf, 'a' + mode, BSIZE);
+    writetmp(s, buf, NB, BSIZE, &info0, &info1);
+    if(info0.journal != mode){
+      printf("%s: journaling mode %d, expected %d\n", s, info0.journal, mode);
+      exit(1);
+    }
+    ninplace[mode] = info1.logdata - info0.logdata;
+
+    fd = open("writetmp", O_RDONLY);
+    if(fd < 0){
+      printf("%s: open writetmp failed\n", s);
+      exit(1);
+    }
+    while((i = read(fd, buf, BSIZE)) > 0){
+      while(--i >= 0){
+        if(buf[i] != 'a' + mode){
+          printf("%s: mode %d read back %x\n", s, mode, buf[i]);
+          exit(1);
+        }
+      }
+    }
+    close(fd);
+    unlink("writetmp");
+  }
+  journal(old);
+
+  if(ninplace[JOURNAL_DATA] != 0){
+    printf("%s: data journaling wrote %d blocks in place\n", s,
+           ninplace[JOURNAL_DATA]);
+    exit(1);
+  }
+  if(ninplace[JOURNAL_ORDERED] < NB){
+    printf("%s: ordered mode wrote %d of %d blocks in place\n", s,
+           ninplace[JOURNAL_ORDERED], NB);
+    exit(1);
+  }
+}
+
+// sequential disk throughput: write a file block by block and
+// sync it, then read it back. the log's batched writes should
+// reach the disk several blocks to a notification. the reads
+// mostly find the blocks cached, so they time the cache path.
+void
+diskbench(char *s)
+{
+  enum { NB=200, ROUNDS=4 };
+  struct sysinfo info0, info1;
+  int r, i, fd, t0, t1, twrite, tread, nblocks, nnotify;
+
+  memset(buf, 'd', BSIZE);
+  sysinfo(&info0);
+  t0 = uptime();
+  for(r = 0; r < ROUNDS; r++){
+    fd = open("diskbench", O_CREATE | O_RDWR);
+    if(fd < 0){
+      printf("%s: cannot create diskbench\n", s);
+      exit(1);
+    }
+    for(i = 0; i < NB; i++){
+      if(write(fd, buf, BSIZE) != BSIZE){
+        printf("%s: write failed\n", s);
+        exit(1);
+      }
+    }
+    close(fd);
+    sync();
+  }
+  twrite = ticksince(t0);
+  sysinfo(&info1);
+  t1 = uptime();
+  for(r = 0; r < ROUNDS; r++){
+    fd = open("diskbench", O_RDONLY);
+    if(fd < 0){
+      printf("%s: cannot open diskbench\n", s);
+      exit(1);
+    }
+    for(i = 0; i < NB; i++){
+      if(read(fd, buf, BSIZE) != BSIZE){
+        printf("%s: read failed\n", s);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+  tread = ticksince(t1);
+  unlink("diskbench");
+
+  nblocks = info1.diskblocks - info0.diskblocks;
+  nnotify = info1.disknotify - info0.disknotify;
+  if(nnotify == 0)
+    nnotify = 1;
+  printf("write %d KB/tick, read %d KB/tick, %d blocks/notify ",
+         ROUNDS*NB*BSIZE/1024 / twrite, ROUNDS*NB*BSIZE/1024 / tread,
+         nblocks / nnotify);
+  if(nblocks < 2 * nnotify){
+    printf("\n%s: %d blocks written with %d notifications\n",
+           s, nblocks, nnotify);
+    exit(1);
+  }
+}
+
+// the ramdisk starts out as a copy of fs.img, loading each
+// block from the virtio disk the first time it is read; the
+// reads ahead that bdevrw() starts load blocks too. writes
+// stay on the ramdisk, unless it is the root (make ROOTDEV=2),
+// which bdevrw() won't write.
+void
+ramdisk(char *s)
+{
+  enum { N=64 };
+  static char vbuf[BSIZE];
+  struct superblock *sb = (struct superblock*)buf;
+  struct stat st;
+  int i;
+
+  if(bdevrw(RAMDEV, 1, buf, 0) < 0 || bdevrw(VIRTIODEV, 1, vbuf, 0) < 0){
+    printf("%s: bdevrw superblock failed\n", s);
+    exit(1);
+  }
+  if(sb->magic != FSMAGIC || memcmp(buf, vbuf, BSIZE) != 0){
+    printf("%s: ramdisk superblock differs from fs.img\n", s);
+    exit(1);
+  }
+  for(i = 2; i < 2 + N; i++){
+    if(bdevrw(RAMDEV, i, buf, 0) < 0){
+      printf("%s: bdevrw read block %d failed\n", s, i);
+      exit(1);
+    }
+  }
+
+  if(stat("/", &st) < 0){
+    printf("%s: stat / failed\n", s);
+    exit(1);
+  }
+  if(st.dev == RAMDEV){
+    if(bdevrw(RAMDEV, FSSIZE-1, buf, 1) != -1){
+      printf("%s: bdevrw wrote the root device\n", s);
+      exit(1);
+    }
+    return;
+  }
+  for(i = 0; i < BSIZE; i++)
+    buf[i] = i * 7;
+  if(bdevrw(RAMDEV, FSSIZE-1, buf, 1) < 0){
+    printf("%s: bdevrw write failed\n", s);
+    exit(1);
+  }
+  memset(buf, 0, BSIZE);
+  if(bdevrw(RAMDEV, FSSIZE-1, buf, 0) < 0){
+    printf("%s: bdevrw read back failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < BSIZE; i++){
+    if(buf[i] != (char)(i * 7)){
+      printf("%s: ramdisk read back wrong data\n", s);
+      exit(1);
+    }
+  }
+}
+
+// the null device reads zeros and takes any write.
+void
+nulldev(char *s)
+{
+  enum { N=32 };
+  int i, j;
+
+  if(bdevrw(0, 0, buf, 0) != -1 || bdevrw(NBDEV, 0, buf, 0) != -1 ||
+     bdevrw(NULLDEV, FSSIZE, buf, 0) != -1){
+    printf("%s: bdevrw accepted a bad device or block\n", s);
+    exit(1);
+  }
+  memset(buf, 'n', BSIZE);
+  if(bdevrw(NULLDEV, N, buf, 1) < 0){
+    printf("%s: bdevrw write failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    memset(buf, 'x', BSIZE);
+    if(bdevrw(NULLDEV, i, buf, 0) < 0){
+      printf("%s: bdevrw read block %d failed\n", s, i);
+      exit(1);
+    }
+    for(j = 0; j < BSIZE; j++){
+      if(buf[j] != 0){
+        printf("%s: null device block %d isn't zero\n", s, i);
+        exit(1);
+      }
+    }
+  }
+}
+
+// write throughput with file data journaled and with ordered
+// data, which writes each data block once instead of twice
+// (see log.c): big writes as in bigwrite, and small ones as
+// in bigfile. ordered data should take no longer.
+void
+journalbench(char *s)
+{
+  enum { NBIG=16, NSMALL=300, SZ=600, ROUNDS=4 };
+  static char *names[] = { "data", "ordered" };
+  int mode, old, r, i, fd, t0, t1, tbig, tsmall, total[2];
+
+  old = journal(JOURNAL_DATA);
+  for(mode = JOURNAL_DATA; mode <= JOURNAL_ORDERED; mode++){
+    journal(mode);
+    // ordered mode logs blocks still in the journal, so
+    // give the writeback thread time to install it.
+    sync();
+    sleep(40);
+
+    t0 = uptime();
+    for(r = 0; r < ROUNDS; r++){
+      fd = open("journalbench", O_CREATE | O_RDWR);
+      if(fd < 0){
+        printf("%s: cannot create journalbench\n", s);
+        exit(1);
+      }
+      for(i = 0; i < NBIG; i++){
+        if(write(fd, buf, BUFSZ) != BUFSZ){
+          printf("%s: big write failed\n", s);
+          exit(1);
+        }
+      }
+      close(fd);
+      unlink("journalbench");
+    }
+    tbig = ticksince(t0);
+    t1 = uptime();
+    for(r = 0; r < ROUNDS; r++){
+      fd = open("journalbench", O_CREATE | O_RDWR);
+      if(fd < 0){
+        printf("%s: cannot create journalbench\n", s);
+        exit(1);
+      }
+      for(i = 0; i < NSMALL; i++){
+        if(write(fd, buf, SZ) != SZ){
+          printf("%s: small write failed\n", s);
+          exit(1);
+        }
+      }
+      close(fd);
+      unlink("journalbench");
+    }
+    tsmall = ticksince(t1);
+    total[mode] = tbig + tsmall;
+    printf("%s: %d big, %d small KB/tick ", names[mode],
+           ROUNDS*NBIG*BUFSZ/1024 / tbig, ROUNDS*NSMALL*SZ/1024 / tsmall);
+  }
+  journal(old);
+
+  if(total[JOURNAL_ORDERED] > total[JOURNAL_DATA]){
+    printf("\n%s: ordered data took %d ticks, data journaling %d\n",
+           s, total[JOURNAL_ORDERED], total[JOURNAL_DATA]);
+    exit(1);
+  }
+}
+
 //
 // use sbrk() to count how many free physical memory pages there are.
 // touches the pages to force allocation.
@@ -2693,6 +3423,22 @@ main(int argc, char *argv[])
     {dirfile, "dirfile"},
     {iref, "iref"},
     {forktest, "forktest"},
+    {kallocscale, "kallocscale"},
+    {bcachescale, "bcachescale"},
+    {bcachegrow, "bcachegrow"},
+    {disknotify, "disknotify"},
+    {ioschedpolicy, "ioschedpolicy"},
+    {diskpolllat, "diskpolllat"},
+    {discardfree, "discardfree"},
+    {readahead, "readahead"},
+    {groupcommit, "groupcommit"},
+    {bigtrans, "bigtrans"},
+    {checkpoint, "checkpoint"},
+    {ordereddata, "ordereddata"},
+    {journalbench, "journalbench"},
+    {diskbench, "diskbench"},
+    {ramdisk, "ramdisk"},
+    {nulldev, "nulldev"},
     {bigdir, "bigdir"}, // slow
     { 0, 0},
   };
@@ -38,3 +38,9 @@ entry("sleep");
 entry("uptime");
 entry("trace");
 entry("sysinfo");
+entry("iosched");
+entry("diskpoll");
+entry("sync");
+entry("journal");
+entry("bdevrw");
+entry("logcrash");